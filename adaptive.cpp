@@ -0,0 +1,333 @@
+#include <math.h>
+#include <chrono>
+#include <map>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Amount of encoder settings per format. Setting 0 is the cheapest one (least
+ * compression effort or lowest quality), the last one the most expensive.
+ */
+#define ADAPTIVE_SETTINGS 5
+
+/**
+ * The controller is updated after this amount of tiles, so that single
+ * expensive tiles don't make the settings jump back and forth.
+ */
+#define ADAPTIVE_UPDATE_TILES 16
+
+/**
+ * Minimal difference in brightness (sum of the horizontal and vertical
+ * difference) for a pixel to count as edge.
+ */
+#define ADAPTIVE_EDGE_THRESHOLD 32
+
+/**
+ * State of the adaptive encoding (s. settings_t.adaptive).
+ *
+ * Each tile gets a base setting from its complexity: Flat tiles are cheap to
+ * compress well, so they get the most effort. Busy tiles are slow to compress
+ * and hide compression artefacts, so they get less effort. The "pressure"
+ * shifts all tiles towards cheaper (positive) or better (negative) settings
+ * depending on whether the run is behind or ahead of its target.
+ */
+typedef struct adaptive
+{
+	double target_tiles_per_second;
+	long byte_budget;
+	long tiles_total;
+
+	int pressure;
+
+	// Progress of the whole run, the speed is measured by the wall-clock time
+	// since "start"
+	std::chrono::steady_clock::time_point start;
+	long tiles_done;
+	uint64_t bytes_done;
+
+	// Time spent for resizing, encoding and passing the tiles on (debug only)
+	double encode_seconds;
+
+	// Statistics of the current zoom level
+	std::chrono::steady_clock::time_point level_start;
+	long level_tiles;
+	uint64_t level_bytes;
+	double level_encode_seconds;
+	double level_complexity;
+	std::map<std::string, long> level_choices;
+} adaptive_t;
+
+/**
+ * Initializes the adaptive encoding for a run.
+ *
+ * @param adaptive The state to initialize.
+ * @param settings The settings containing the targets.
+ * @param tiles_total The amount of tiles (of all variants) the run will create.
+ */
+static void
+adaptive_init(adaptive_t *adaptive, const settings_t &settings, long tiles_total)
+{
+	adaptive->target_tiles_per_second = settings.target_tiles_per_second;
+	adaptive->byte_budget = settings.byte_budget;
+	adaptive->tiles_total = std::max(tiles_total, 1L);
+	adaptive->pressure = 0;
+
+	adaptive->start = std::chrono::steady_clock::now();
+	adaptive->tiles_done = 0;
+	adaptive->bytes_done = 0;
+	adaptive->encode_seconds = 0;
+
+	adaptive->level_start = adaptive->start;
+	adaptive->level_tiles = 0;
+	adaptive->level_bytes = 0;
+	adaptive->level_encode_seconds = 0;
+	adaptive->level_complexity = 0;
+	adaptive->level_choices.clear();
+}
+
+/**
+ * Estimates how hard the tile is to compress by its brightness spread and the
+ * amount of edges. Both are determined in one pass over the pixels of the
+ * resized tile. This pass is separate from the resampling, which is done by
+ * cv::resize, but it is cheap compared to the encoding.
+ *
+ * @param tile The resized tile with 8 bit per channel.
+ * @return The complexity from 0 (flat) to 1 (very busy).
+ */
+static double
+tile_complexity(const cv::Mat &tile)
+{
+	int channels = tile.channels();
+	std::vector<int> previous(tile.cols);
+	std::vector<int> current(tile.cols);
+
+	double sum = 0;
+	double sum_sq = 0;
+	long edges = 0;
+
+	for (int y = 0; y < tile.rows; y++)
+	{
+		const uchar *row = tile.ptr<uchar>(y);
+
+		for (int x = 0; x < tile.cols; x++)
+		{
+			const uchar *p = row + x * channels;
+			int v = channels >= 3 ? (p[0] + 2 * p[1] + p[2]) >> 2 : p[0];
+
+			current[x] = v;
+			sum += v;
+			sum_sq += v * v;
+
+			if (x > 0 && y > 0 && abs(v - current[x - 1]) + abs(v - previous[x]) > ADAPTIVE_EDGE_THRESHOLD)
+			{
+				edges++;
+			}
+		}
+
+		std::swap(previous, current);
+	}
+
+	double n = (double)tile.rows * tile.cols;
+	if (n == 0)
+	{
+		return 0;
+	}
+
+	double mean = sum / n;
+	double stddev = sqrt(std::max(sum_sq / n - mean * mean, 0.0));
+
+	double spread = std::min(stddev / 64.0, 1.0);
+	double edge_density = std::min(4.0 * edges / n, 1.0);
+
+	return (spread + edge_density) / 2;
+}
+
+/**
+ * Determines the encoder parameters of one setting for the given format.
+ *
+ * @param format The tile format, e.g. "png".
+ * @param setting The index of the setting (0 .. ADAPTIVE_SETTINGS-1).
+ * @param params Output parameter, the parameters for cv::imencode.
+ * @return The name of the setting for the statistics, empty when the format
+ * has no adjustable settings.
+ */
+static std::string
+adaptive_params(const std::string &format, int setting, std::vector<int> *params)
+{
+	static const int png_levels[ADAPTIVE_SETTINGS] = { 1, 3, 6, 8, 9 };
+	static const int qualities[ADAPTIVE_SETTINGS] = { 70, 78, 85, 90, 95 };
+
+	params->clear();
+
+	if (format == "png")
+	{
+		// Filtering suits the busy tiles, which get the low levels
+		int strategy = setting < 2 ? cv::IMWRITE_PNG_STRATEGY_FILTERED : cv::IMWRITE_PNG_STRATEGY_DEFAULT;
+		*params = { cv::IMWRITE_PNG_COMPRESSION, png_levels[setting], cv::IMWRITE_PNG_STRATEGY, strategy };
+		return "png-z" + std::to_string(png_levels[setting]) + (setting < 2 ? "f" : "");
+	}
+	else if (format == "jpg" || format == "jpeg" || format == "jpe")
+	{
+		*params = { cv::IMWRITE_JPEG_QUALITY, qualities[setting] };
+		return "jpg-q" + std::to_string(qualities[setting]);
+	}
+	else if (format == "webp")
+	{
+		*params = { cv::IMWRITE_WEBP_QUALITY, qualities[setting] };
+		return "webp-q" + std::to_string(qualities[setting]);
+	}
+
+	return "";
+}
+
+/**
+ * Chooses the encoder parameters for a tile.
+ *
+ * @param adaptive The state of the adaptive encoding.
+ * @param format The tile format, e.g. "png".
+ * @param complexity The complexity of the tile (s. tile_complexity).
+ * @param params Output parameter, the parameters for cv::imencode.
+ * @return The name of the chosen setting (s. adaptive_params).
+ */
+static std::string
+adaptive_choose(adaptive_t *adaptive, const std::string &format, double complexity, std::vector<int> *params)
+{
+	int base = (int)lround((1 - complexity) * (ADAPTIVE_SETTINGS - 1));
+
+	// A higher PNG compression level is the only way to save bytes of a
+	// lossless format, for all other cases the cheaper setting is the lower
+	// one.
+	int shift = -adaptive->pressure;
+	if (adaptive->byte_budget > 0 && format == "png")
+	{
+		shift = adaptive->pressure;
+	}
+
+	int setting = std::min(std::max(base + shift, 0), ADAPTIVE_SETTINGS - 1);
+	return adaptive_params(format, setting, params);
+}
+
+/**
+ * Records an encoded tile and adjusts the pressure when the run is behind or
+ * ahead of its target.
+ *
+ * @param adaptive The state of the adaptive encoding.
+ * @param choice The name of the chosen setting.
+ * @param complexity The complexity of the tile.
+ * @param bytes The size of the encoded tile.
+ * @param encode_seconds The time needed to resize, encode and pass on the
+ * tile.
+ */
+static void
+adaptive_tile_done(adaptive_t *adaptive, const std::string &choice, double complexity, size_t bytes, double encode_seconds)
+{
+	adaptive->tiles_done++;
+	adaptive->bytes_done += bytes;
+	adaptive->encode_seconds += encode_seconds;
+
+	adaptive->level_tiles++;
+	adaptive->level_bytes += bytes;
+	adaptive->level_encode_seconds += encode_seconds;
+	adaptive->level_complexity += complexity;
+	if (!choice.empty())
+	{
+		adaptive->level_choices[choice]++;
+	}
+
+	if (adaptive->tiles_done % ADAPTIVE_UPDATE_TILES != 0)
+	{
+		return;
+	}
+
+	// Ratio of the used to the planned time or bytes, above 1 is behind. The
+	// time includes waiting for the decoder and the pyramid, which the
+	// settings can't change, but it's what the run takes.
+	double usage = 1;
+	if (adaptive->target_tiles_per_second > 0)
+	{
+		double planned_seconds = adaptive->tiles_done / adaptive->target_tiles_per_second;
+		usage = seconds_since(adaptive->start) / planned_seconds;
+	}
+	else if (adaptive->byte_budget > 0)
+	{
+		double planned_bytes = (double)adaptive->byte_budget * adaptive->tiles_done / adaptive->tiles_total;
+		usage = adaptive->bytes_done / planned_bytes;
+	}
+
+	if (usage > 1.05)
+	{
+		adaptive->pressure = std::min(adaptive->pressure + 1, ADAPTIVE_SETTINGS - 1);
+	}
+	else if (usage < 0.9)
+	{
+		adaptive->pressure = std::max(adaptive->pressure - 1, -(ADAPTIVE_SETTINGS - 1));
+	}
+
+	DLOG("Adaptive encoding: usage %.2f, pressure %d", usage, adaptive->pressure);
+}
+
+/**
+ * Prints the statistics of the finished zoom level and resets them.
+ *
+ * @param adaptive The state of the adaptive encoding.
+ * @param z The finished zoom level.
+ */
+static void
+adaptive_level_done(adaptive_t *adaptive, int z)
+{
+	if (adaptive->level_tiles == 0)
+	{
+		return;
+	}
+
+	std::string choices;
+	for (const auto &choice : adaptive->level_choices)
+	{
+		choices += " " + choice.first + ":" + std::to_string(choice.second);
+	}
+
+	LOG("Zoom level %d: %ld tiles, %.1f MiB, %.0f tiles/s, complexity %.2f, settings:%s",
+		z,
+		adaptive->level_tiles,
+		adaptive->level_bytes / (1024.0 * 1024.0),
+		adaptive->level_tiles / std::max(seconds_since(adaptive->level_start), 1e-9),
+		adaptive->level_complexity / adaptive->level_tiles,
+		choices.empty() ? " none" : choices.c_str());
+	DLOG("Zoom level %d: %.0f tiles/s without waiting for image rows",
+		z,
+		adaptive->level_tiles / std::max(adaptive->level_encode_seconds, 1e-9));
+
+	adaptive->level_start = std::chrono::steady_clock::now();
+	adaptive->level_tiles = 0;
+	adaptive->level_bytes = 0;
+	adaptive->level_encode_seconds = 0;
+	adaptive->level_complexity = 0;
+	adaptive->level_choices.clear();
+}
+
+/**
+ * Prints the result of the whole run.
+ *
+ * @param adaptive The state of the adaptive encoding.
+ */
+static void
+adaptive_report(const adaptive_t *adaptive)
+{
+	double seconds = seconds_since(adaptive->start);
+
+	LOG("Adaptive encoding: %ld tiles, %.1f MiB, %.0f tiles/s",
+		adaptive->tiles_done,
+		adaptive->bytes_done / (1024.0 * 1024.0),
+		adaptive->tiles_done / std::max(seconds, 1e-9));
+	DLOG("Adaptive encoding: %.0f tiles/s without waiting for image rows",
+		adaptive->tiles_done / std::max(adaptive->encode_seconds, 1e-9));
+
+	if (adaptive->byte_budget > 0 && adaptive->bytes_done > (uint64_t)adaptive->byte_budget)
+	{
+		WLOG("The byte budget of %.1f MiB has been exceeded", adaptive->byte_budget / (1024.0 * 1024.0));
+	}
+	if (adaptive->target_tiles_per_second > 0 && adaptive->tiles_done < adaptive->target_tiles_per_second * seconds)
+	{
+		WLOG("The target of %.0f tiles/s has not been reached", adaptive->target_tiles_per_second);
+	}
+}
@@ -0,0 +1,366 @@
+#include <getopt.h>
+#include <experimental/filesystem>
+#include <regex>
+#include <sstream>
+
+/**
+ * Asks the user to proceed.
+ *
+ * @return true is the user wants to proceed, false otherwise.
+ */
+bool
+req_confirm()
+{
+	char choice;
+	bool success = false;
+
+    while(true)
+    {
+        std::cout << "Proceed? [Y/n]" << std::endl;
+        std::cin >> choice;
+
+        if (choice == 'N' || choice == 'n')
+		{
+			success = false;
+            break;
+        }
+		else if (choice == 'Y')
+		{
+			success = true;
+			break;
+		}
+    }
+
+	return success;
+}
+
+/**
+ * Splits the given string at each occurrence of the delimiter. Empty parts are
+ * ignored.
+ *
+ * @param str The string to split, e.g. "256,512".
+ * @param delimiter The character separating the parts.
+ * @return The parts of the string without delimiters.
+ */
+std::vector<std::string>
+split(const std::string &str, char delimiter)
+{
+	std::vector<std::string> parts;
+	std::stringstream stream(str);
+	std::string part;
+
+	while (std::getline(stream, part, delimiter))
+	{
+		if (!part.empty())
+		{
+			parts.push_back(part);
+		}
+	}
+
+	return parts;
+}
+
+/**
+ * Parses an amount of bytes with an optional suffix (K, M or G for KiB, MiB
+ * and GiB).
+ *
+ * @param str The string to parse, e.g. "500M".
+ * @return The amount of bytes.
+ */
+long
+parse_bytes(const std::string &str)
+{
+	char *suffix;
+	double value = strtod(str.c_str(), &suffix);
+
+	switch (toupper(*suffix))
+	{
+		case 'G':
+			value *= 1024;
+			// fall through
+		case 'M':
+			value *= 1024;
+			// fall through
+		case 'K':
+			value *= 1024;
+			break;
+	}
+
+	return (long)value;
+}
+
+void
+print_usage()
+{
+	LOG("image2tiles - Cutting an image into XYZ-tiles.");
+	LOG("");
+	LOG("Options:");
+	LOG("  -1, --p1               First point using a point string (1)");
+	LOG("  -2, --p2               Second point using a point string (1)");
+	LOG("  -z, --max-zoom-level   Maximal zoom level (0..19). Tiles will have a");
+	LOG("                         zoom level less or equal to this.");
+	LOG("  -t, --tile-size        Comma separated sizes of a tile in pixel");
+	LOG("                         (default: 256). E.g. \"256,512\" for normal");
+	LOG("                         and @2x tiles in one run.");
+	LOG("      --format           Comma separated tile formats (default: png)");
+	LOG("      --cog              Additionally write a Cloud-Optimized GeoTIFF");
+	LOG("                         with one overview per zoom level to this file");
+	LOG("      --target-tps       Adjust the encoder settings (s. --adaptive) to");
+	LOG("                         create this amount of tiles per second");
+	LOG("      --byte-budget      Adjust the encoder settings (s. --adaptive) to");
+	LOG("                         stay within this total size of all tiles.");
+	LOG("                         Suffixes K, M and G are allowed, e.g. \"500M\"");
+	LOG("  -o, --output-folder    Output folder (defult: .out/)");
+	LOG("  -f, --file             The image file that should be cutted");
+	LOG("");
+	LOG("Flags:");
+	LOG("  -v, --verbose          More detailed output");
+	LOG("  -d, --debug            Even more output including debug logging");
+	LOG("      --no-tiles         Do not write XYZ-tiles (e.g. only --cog)");
+	LOG("      --dedup            Store identical tiles only once and create");
+	LOG("                         hardlinks to them");
+	LOG("      --adaptive         Choose the encoder settings (compression");
+	LOG("                         level, quality) per tile by its complexity");
+	LOG("      --version          Version of this application");
+	LOG("  -h, --help             Prints this message");
+	LOG("");
+	LOG("");
+	LOG("");
+	LOG("(1) Point string:");
+	LOG("");
+	LOG("A string representing the mapping from an image pixel to longitude/\n\
+latitude degrees. Specifying two points is used to determine the scale and\n\
+starting tiles of the image.");
+	LOG("It is formatted as followed:");
+	LOG("");
+	LOG("    <pixel-X>,<longitude>,<pixel-Y>,<latitude>");
+	LOG("");
+	LOG("Example:");
+	LOG("");
+	LOG("    771,43.55,220,-14.96");
+	LOG("");
+	LOG("The further away these points are on the image, the better is the\n\
+accuracy. Choosing the top-left and bottom-right corners of the image will\n\
+result in the best accuracy. Be sure the points do not have similar x oder y\n\
+coordinated (therefore two diagonal placed points are good)");
+	LOG("To fine the longitude/latitude of a point an online service can be used\n\
+(e.g. https://openstreetmap.org).");
+	LOG("");
+	LOG("");
+	LOG("");
+	LOG("License:     GPL-3.0");
+	LOG("Source code: https://github.com/hauke96/image2tiles");
+}
+
+void
+parse_args(int argc, char** argv, settings_t *settings)
+{
+	default_settings(settings);
+
+	std::vector<int> sizes = { settings->variants[0].size };
+	std::vector<std::string> formats = { settings->variants[0].format };
+	bool no_tiles = false;
+
+	// Regex for parsing the points
+	std::string float_regex_str = "[+-]?[\\d]*\\.?[\\d]+";
+	std::string int_regex_str = "[-+]?\\d+";
+	// For example: --p1=100,20.123,100,64.123
+	std::regex point_regex("(" + int_regex_str + "),(" + float_regex_str + "),(" + int_regex_str + "),(" + float_regex_str + ")");
+
+	static struct option long_options[] = {
+		{"max-zoom-level", required_argument, 0, 'z' },
+		{"tile-size",      required_argument, 0, 't' },
+		{"format",         required_argument, 0,  0  },
+		{"cog",            required_argument, 0,  0  },
+		{"no-tiles",       no_argument,       0,  0  },
+		{"dedup",          no_argument,       0,  0  },
+		{"adaptive",       no_argument,       0,  0  },
+		{"target-tps",     required_argument, 0,  0  },
+		{"byte-budget",    required_argument, 0,  0  },
+		{"p1",             required_argument, 0, '1' },
+		{"p2",             required_argument, 0, '2' },
+		{"file",           required_argument, 0, 'f' },
+		{"output-folder",  required_argument, 0, 'o' },
+		{"verbose",        no_argument,       0, 'v' },
+		{"version",        no_argument,       0,  0  },
+		{"debug",          no_argument,       0, 'd' },
+		{"help",           no_argument,       0, 'h' },
+		{0,                0,                 0,  0  }
+	};
+	
+	while (1)
+	{
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hvdo:f:z:1:2:t:",
+			long_options, &option_index);
+		if (c == -1)
+		{
+			break;
+		}
+
+		switch (c)
+		{
+			case 0:
+			{
+				std::string opt = long_options[option_index].name;
+
+				if (opt == "version")
+				{
+					LOG(VERSION);
+					exit(0);
+				}
+				else if (opt == "format")
+				{
+					formats = split(optarg, ',');
+				}
+				else if (opt == "cog")
+				{
+					settings->cog_file = optarg;
+				}
+				else if (opt == "no-tiles")
+				{
+					no_tiles = true;
+				}
+				else if (opt == "dedup")
+				{
+					settings->dedup = true;
+				}
+				else if (opt == "adaptive")
+				{
+					settings->adaptive = true;
+				}
+				else if (opt == "target-tps")
+				{
+					settings->adaptive = true;
+					settings->target_tiles_per_second = atof(optarg);
+				}
+				else if (opt == "byte-budget")
+				{
+					settings->adaptive = true;
+					settings->byte_budget = parse_bytes(optarg);
+				}
+
+				break;
+			}
+			case '1': // fall through
+			case '2':
+			{
+				std::smatch matches;
+				std::string arg_str(optarg);
+				if (std::regex_search(arg_str, matches, point_regex))
+				{
+					img_point_t *p;
+					if (c == '1')
+					{
+						p = &settings->p1;
+					}
+					else
+					{
+						p = &settings->p2;
+					}
+					p->x = atoi(matches.str(1).c_str());
+					p->lon = std::stof(matches.str(2).c_str());
+					p->y = atoi(matches.str(3).c_str());
+					p->lat = std::stof(matches.str(4).c_str());
+					DLOG("> %d", p->x);
+					DLOG("> %f", p->lon);
+					DLOG("> %d", p->y);
+					DLOG("> %f", p->lat);
+				}
+				else
+				{
+					ELOG("Cannot parse point '%s'", optarg);
+					LOG("A correct point option would be: --p1=1,-23,45,+6.78");
+					LOG("(The + is optional and make sure there are no spaces)");
+					exit(EINVAL);
+				}
+
+				break;
+			}
+			case 't':
+				sizes.clear();
+				for (const std::string &size : split(optarg, ','))
+				{
+					sizes.push_back(atoi(size.c_str()));
+				}
+				break;
+			case 'v':
+				VERBOSE = 1;
+				break;
+			case 'd':
+				DEBUG = 1;
+				VERBOSE = 1;
+				break;
+			case 'f':
+				settings->file = optarg;
+				break;
+			case 'o':
+				settings->output_folder = optarg;
+				break;
+			case 'z':
+				settings->zoom_level = atoi(optarg);
+				break;
+			case 'h':
+				print_usage();
+				exit(0);
+			case '?':
+				ELOG("Unrecognized option '%s'", optarg);
+				// TODO maybe we should not directly exit here? When --help is specified, it would be nice to see the usage information anyway. Generally it would be nice to print the help message when an unrecognized parameter is passed.
+				exit(EINVAL);
+		}
+	}
+
+	// Every tile size is generated in every format
+	settings->variants.clear();
+	for (int size : no_tiles ? std::vector<int>() : sizes)
+	{
+		for (const std::string &format : formats)
+		{
+			settings->variants.push_back({ size, format });
+		}
+	}
+}
+
+/**
+ * Check if the settings only needed by the command line application (input
+ * file and outputs) are valid. If not, it prints an error message and
+ * returns an error code.
+ *
+ * When the output folder already exists, the user is asked whether to proceed.
+ * When the user declines, this function exits the application.
+ *
+ * @param settings The settings to verify
+ * @return 0 when succeeded, a positive number of not.
+ */
+int
+verify_cli_settings(settings_t *settings)
+{
+	// imput file exists
+	if (!std::experimental::filesystem::exists(settings->file))
+	{
+		ELOG("Input file does not exist");
+		return 3;
+	}
+
+	// Something must be written
+	if (settings->variants.empty() && settings->cog_file.empty())
+	{
+		ELOG("Neither tiles nor a GeoTIFF should be written");
+		return 6;
+	}
+
+	// Output folder already exists -> Warning, data might be overwritten
+	if (!settings->variants.empty() && std::experimental::filesystem::exists(settings->output_folder))
+	{
+		WLOG("There's already something called '%s'. Data might be overwritten.", settings->output_folder.c_str());
+		bool ok = req_confirm();
+
+		if (!ok)
+		{
+			// Exit but no error occured, so do not return an error code.
+			exit(0);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,554 @@
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <zlib.h>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Width and height of the internal tiles of the GeoTIFF in pixel.
+ */
+#define COG_BLOCK_SIZE 256
+
+/**
+ * The zlib compression level (1..9) of the internal tiles.
+ */
+#define COG_DEFLATE_LEVEL 6
+
+// TIFF field types
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_DOUBLE 12
+#define TIFF_LONG8 16
+
+/**
+ * One entry (tag) of an image file directory (IFD) of a TIFF file. The values
+ * are already encoded as little endian bytes.
+ */
+typedef struct tiff_entry
+{
+	uint16_t tag;
+	uint16_t type;
+	uint64_t count;
+	std::vector<uchar> data;
+} tiff_entry_t;
+
+/**
+ * One resolution level of the GeoTIFF, which is the image of one zoom level.
+ * Level 0 is the full resolution image, all other levels are overviews.
+ *
+ * The compressed tiles are written into a spill file first, because the
+ * overviews have to be placed in front of the full resolution image but they
+ * are generated afterwards. The offsets are relative to the spill file.
+ */
+typedef struct cog_level
+{
+	cv::Size size;
+	int tiles_x;
+	int tiles_y;
+	std::string spill_file;
+	uint64_t spill_size;
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> byte_counts;
+} cog_level_t;
+
+/**
+ * A Cloud-Optimized GeoTIFF (COG) that is written level by level while the
+ * image is cut. The layout of the final file is:
+ *
+ *    header, IFD level 0, IFD level 1, ..., tiles of the last level, ...,
+ *    tiles of level 1, tiles of level 0
+ *
+ * So all IFDs are at the beginning and the smallest overviews come first,
+ * which is what COG readers expect.
+ */
+typedef struct cog
+{
+	std::string file;
+	int channels;
+	int max_zoom_level;
+
+	// Georeference of the full resolution image (s. fill_tile_settings)
+	double origin_long;
+	double origin_lat;
+	double pixel_per_long;
+	double pixel_per_lat;
+
+	std::vector<cog_level_t> levels;
+} cog_t;
+
+/**
+ * Appends the value as little endian number with the given amount of bytes.
+ */
+void
+put_le(std::vector<uchar> &out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		out.push_back((value >> (8 * i)) & 0xff);
+	}
+}
+
+/**
+ * @return The size in bytes of one value of the given TIFF field type.
+ */
+int
+tiff_type_size(uint16_t type)
+{
+	switch (type)
+	{
+		case TIFF_SHORT:
+			return 2;
+		case TIFF_LONG:
+			return 4;
+		default:
+			// TIFF_DOUBLE and TIFF_LONG8
+			return 8;
+	}
+}
+
+/**
+ * Creates a TIFF entry with integer values.
+ *
+ * @param tag The TIFF tag.
+ * @param type The TIFF field type (TIFF_SHORT, TIFF_LONG or TIFF_LONG8).
+ * @param values The values of the entry.
+ */
+tiff_entry_t
+tiff_entry(uint16_t tag, uint16_t type, const std::vector<uint64_t> &values)
+{
+	tiff_entry_t entry = { tag, type, values.size(), {} };
+	for (uint64_t value : values)
+	{
+		put_le(entry.data, value, tiff_type_size(type));
+	}
+	return entry;
+}
+
+/**
+ * Creates a TIFF entry with floating point values.
+ *
+ * @param tag The TIFF tag.
+ * @param values The values of the entry.
+ */
+tiff_entry_t
+tiff_double_entry(uint16_t tag, const std::vector<double> &values)
+{
+	tiff_entry_t entry = { tag, TIFF_DOUBLE, values.size(), {} };
+	for (double value : values)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		put_le(entry.data, bits, 8);
+	}
+	return entry;
+}
+
+/**
+ * Calculates the size of an IFD including the values that do not fit into the
+ * entries and are stored behind the IFD.
+ *
+ * @param entries The entries of the IFD.
+ * @param bigtiff True for the BigTIFF format, false for classic TIFF.
+ * @return The size in bytes.
+ */
+uint64_t
+tiff_ifd_size(const std::vector<tiff_entry_t> &entries, bool bigtiff)
+{
+	size_t word = bigtiff ? 8 : 4;
+	uint64_t size = (bigtiff ? 8 : 2) + entries.size() * (bigtiff ? 20 : 12) + word;
+
+	for (const tiff_entry_t &entry : entries)
+	{
+		if (entry.data.size() > word)
+		{
+			size += entry.data.size() + entry.data.size() % 2;
+		}
+	}
+
+	return size;
+}
+
+/**
+ * Appends the IFD and the values not fitting into the entries. The current
+ * size of "out" is the position of the IFD within the file.
+ *
+ * @param out The beginning of the TIFF file.
+ * @param entries The entries of the IFD sorted by their tags.
+ * @param next_ifd The offset of the next IFD or 0 for the last one.
+ * @param bigtiff True for the BigTIFF format, false for classic TIFF.
+ */
+void
+tiff_write_ifd(std::vector<uchar> &out, const std::vector<tiff_entry_t> &entries, uint64_t next_ifd, bool bigtiff)
+{
+	size_t word = bigtiff ? 8 : 4;
+	uint64_t external_offset = out.size() + (bigtiff ? 8 : 2) + entries.size() * (bigtiff ? 20 : 12) + word;
+	std::vector<uchar> external;
+
+	put_le(out, entries.size(), bigtiff ? 8 : 2);
+
+	for (const tiff_entry_t &entry : entries)
+	{
+		put_le(out, entry.tag, 2);
+		put_le(out, entry.type, 2);
+		put_le(out, entry.count, word);
+
+		if (entry.data.size() <= word)
+		{
+			// Small values are stored in the entry itself
+			out.insert(out.end(), entry.data.begin(), entry.data.end());
+			put_le(out, 0, word - entry.data.size());
+		}
+		else
+		{
+			put_le(out, external_offset + external.size(), word);
+			external.insert(external.end(), entry.data.begin(), entry.data.end());
+
+			// Values must start on a word boundary
+			if (external.size() % 2 != 0)
+			{
+				external.push_back(0);
+			}
+		}
+	}
+
+	put_le(out, next_ifd, word);
+	out.insert(out.end(), external.begin(), external.end());
+}
+
+/**
+ * Creates the entries of the IFD of one level.
+ *
+ * @param cog The COG.
+ * @param level The index of the level.
+ * @param offsets The absolute file offsets of the tiles of this level.
+ * @param bigtiff True for the BigTIFF format, false for classic TIFF.
+ * @return The entries sorted by their tag.
+ */
+std::vector<tiff_entry_t>
+cog_ifd_entries(const cog_t *cog, int level, const std::vector<uint64_t> &offsets, bool bigtiff)
+{
+	const cog_level_t *l = &cog->levels[level];
+	uint16_t offset_type = bigtiff ? TIFF_LONG8 : TIFF_LONG;
+	uint64_t channels = cog->channels;
+
+	std::vector<tiff_entry_t> entries;
+
+	// NewSubfileType: 1 means reduced resolution image (overview)
+	entries.push_back(tiff_entry(254, TIFF_LONG, { level == 0 ? 0u : 1u }));
+	entries.push_back(tiff_entry(256, TIFF_LONG, { (uint64_t)l->size.width }));
+	entries.push_back(tiff_entry(257, TIFF_LONG, { (uint64_t)l->size.height }));
+	entries.push_back(tiff_entry(258, TIFF_SHORT, std::vector<uint64_t>(channels, 8)));
+	// Compression: Adobe deflate
+	entries.push_back(tiff_entry(259, TIFF_SHORT, { 8 }));
+	// Photometric interpretation: min-is-black or RGB
+	entries.push_back(tiff_entry(262, TIFF_SHORT, { channels >= 3 ? 2u : 1u }));
+	entries.push_back(tiff_entry(277, TIFF_SHORT, { channels }));
+	// Planar configuration: contiguous
+	entries.push_back(tiff_entry(284, TIFF_SHORT, { 1 }));
+	// Predictor: horizontal differencing
+	entries.push_back(tiff_entry(317, TIFF_SHORT, { 2 }));
+	entries.push_back(tiff_entry(322, TIFF_SHORT, { COG_BLOCK_SIZE }));
+	entries.push_back(tiff_entry(323, TIFF_SHORT, { COG_BLOCK_SIZE }));
+	entries.push_back(tiff_entry(324, offset_type, offsets));
+	entries.push_back(tiff_entry(325, offset_type, l->byte_counts));
+
+	// Extra samples: the alpha channel is unassociated alpha
+	if (channels == 2 || channels == 4)
+	{
+		entries.push_back(tiff_entry(338, TIFF_SHORT, { 2 }));
+	}
+
+	// The overviews inherit the georeference of the full resolution image
+	if (level == 0)
+	{
+		// ModelPixelScaleTag
+		entries.push_back(tiff_double_entry(33550, { 1.0 / cog->pixel_per_long, 1.0 / cog->pixel_per_lat, 0.0 }));
+		// ModelTiepointTag: pixel (0, 0) is at the origin
+		entries.push_back(tiff_double_entry(33922, { 0.0, 0.0, 0.0, cog->origin_long, cog->origin_lat, 0.0 }));
+		// GeoKeyDirectoryTag: version 1.1.0 with 3 keys
+		entries.push_back(tiff_entry(34735, TIFF_SHORT, {
+			1, 1, 0, 3,
+			1024, 0, 1, 2,   // GTModelTypeGeoKey: geographic
+			1025, 0, 1, 1,   // GTRasterTypeGeoKey: pixel is area
+			2048, 0, 1, 4326 // GeographicTypeGeoKey: WGS 84
+		}));
+	}
+
+	return entries;
+}
+
+/**
+ * Compresses one internal tile of the image. Tiles at the right and bottom
+ * edge are filled up with zeros.
+ *
+ * @param img The image of the level.
+ * @param tile_x The column of the tile.
+ * @param tile_y The row of the tile.
+ * @param compressed Output parameter, the deflate compressed tile.
+ * @return The zlib error code, Z_OK when succeeded.
+ */
+int
+cog_compress_tile(const cv::Mat &img, int tile_x, int tile_y, std::vector<uchar> *compressed)
+{
+	int channels = img.channels();
+	int row_bytes = COG_BLOCK_SIZE * channels;
+	int x0 = tile_x * COG_BLOCK_SIZE;
+	int y0 = tile_y * COG_BLOCK_SIZE;
+	int width = std::min(COG_BLOCK_SIZE, img.cols - x0);
+	int height = std::min(COG_BLOCK_SIZE, img.rows - y0);
+
+	std::vector<uchar> raw(row_bytes * COG_BLOCK_SIZE, 0);
+
+	for (int y = 0; y < height; y++)
+	{
+		uchar *row = raw.data() + y * row_bytes;
+		memcpy(row, img.ptr<uchar>(y0 + y) + x0 * channels, width * channels);
+
+		// OpenCV uses BGR(A), TIFF uses RGB(A)
+		if (channels >= 3)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				std::swap(row[x * channels], row[x * channels + 2]);
+			}
+		}
+
+		// Horizontal differencing (predictor 2), from right to left to use the
+		// original values
+		for (int i = row_bytes - 1; i >= channels; i--)
+		{
+			row[i] -= row[i - channels];
+		}
+	}
+
+	uLongf size = compressBound(raw.size());
+	compressed->resize(size);
+	int err = compress2(compressed->data(), &size, raw.data(), raw.size(), COG_DEFLATE_LEVEL);
+	compressed->resize(err == Z_OK ? size : 0);
+
+	return err;
+}
+
+/**
+ * Prepares the COG. The levels are then added using cog_write_level and the
+ * file is written by cog_finish.
+ *
+ * @param cog The COG to initialize.
+ * @param file The path of the GeoTIFF file.
+ * @param settings The filled settings containing the georeference.
+ * @param img The original image.
+ * @return 0 when succeeded, a positive number if not.
+ */
+int
+cog_start(cog_t *cog, const std::string &file, const settings_t &settings, cv::Mat img)
+{
+	if (img.depth() != CV_8U || img.channels() > 4)
+	{
+		ELOG("GeoTIFF output only supports images with 8 bit per channel and up to 4 channels");
+		return EINVAL;
+	}
+
+	cog->file = file;
+	cog->channels = img.channels();
+	cog->max_zoom_level = settings.zoom_level;
+	cog->origin_long = settings.origin_long;
+	cog->origin_lat = settings.origin_lat;
+	cog->pixel_per_long = settings.pixel_per_long;
+	cog->pixel_per_lat = settings.pixel_per_lat;
+
+	// Same sizes as the levels of the pyramid
+	cv::Size size = img.size();
+	cog->levels.resize(settings.zoom_level + 1);
+	for (size_t i = 0; i < cog->levels.size(); i++)
+	{
+		cog_level_t *level = &cog->levels[i];
+		level->size = size;
+		level->tiles_x = (size.width + COG_BLOCK_SIZE - 1) / COG_BLOCK_SIZE;
+		level->tiles_y = (size.height + COG_BLOCK_SIZE - 1) / COG_BLOCK_SIZE;
+		level->spill_file = file + "." + std::to_string(i) + ".tmp";
+		level->spill_size = 0;
+
+		size = cv::Size(std::max(1, size.width / 2), std::max(1, size.height / 2));
+	}
+
+	return 0;
+}
+
+/**
+ * Compresses all tiles of one zoom level into the spill file of this level.
+ * The tiles of one row are compressed in parallel, so only one row of
+ * compressed tiles is kept in memory.
+ *
+ * @param cog The COG.
+ * @param z The zoom level.
+ * @param img The complete image of this zoom level.
+ * @return 0 when succeeded, a positive number if not.
+ */
+int
+cog_write_level(cog_t *cog, int z, cv::Mat img)
+{
+	cog_level_t *level = &cog->levels[cog->max_zoom_level - z];
+
+	if (img.size().width != level->size.width || img.size().height != level->size.height)
+	{
+		ELOG("Image of zoom level %d has an unexpected size", z);
+		return EINVAL;
+	}
+
+	VLOG("Write GeoTIFF level Z:%d", z);
+
+	std::ofstream spill(level->spill_file, std::ios::binary);
+	std::vector<std::vector<uchar>> compressed(level->tiles_x);
+	std::atomic<int> zlib_err(Z_OK);
+
+	for (int tile_y = 0; tile_y < level->tiles_y; tile_y++)
+	{
+		cv::parallel_for_(cv::Range(0, level->tiles_x), [&img, &compressed, &zlib_err, tile_y](const cv::Range &range) {
+			for (int tile_x = range.start; tile_x < range.end; tile_x++)
+			{
+				int err = cog_compress_tile(img, tile_x, tile_y, &compressed[tile_x]);
+				if (err != Z_OK)
+				{
+					zlib_err = err;
+				}
+			}
+		});
+
+		if (zlib_err != Z_OK)
+		{
+			ELOG("Could not compress GeoTIFF tile of zoom level %d: %s", z, zError(zlib_err));
+			return EIO;
+		}
+
+		for (const std::vector<uchar> &tile : compressed)
+		{
+			level->offsets.push_back(level->spill_size);
+			level->byte_counts.push_back(tile.size());
+			spill.write((const char *)tile.data(), tile.size());
+			level->spill_size += tile.size();
+		}
+	}
+
+	if (!spill)
+	{
+		ELOG("Could not write temporary file '%s'", level->spill_file.c_str());
+		return EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * Removes the spill files of all levels. Is used when the COG can't be
+ * finished, e.g. because an error occurred while cutting the image.
+ *
+ * @param cog The COG.
+ */
+void
+cog_abort(cog_t *cog)
+{
+	for (const cog_level_t &level : cog->levels)
+	{
+		remove(level.spill_file.c_str());
+	}
+}
+
+/**
+ * Writes the GeoTIFF file out of the spill files of all levels and removes
+ * them. When the file would be larger than 4 GiB, BigTIFF is used.
+ *
+ * @param cog The COG whose levels have all been written.
+ * @return 0 when succeeded, a positive number if not.
+ */
+int
+cog_finish(cog_t *cog)
+{
+	int level_count = cog->levels.size();
+	bool bigtiff = false;
+	std::vector<std::vector<uint64_t>> offsets(level_count);
+	uint64_t header_size;
+
+	while (true)
+	{
+		// The sizes of the IFDs do not depend on the offset values
+		header_size = bigtiff ? 16 : 8;
+		for (int i = 0; i < level_count; i++)
+		{
+			offsets[i].assign(cog->levels[i].offsets.size(), 0);
+			header_size += tiff_ifd_size(cog_ifd_entries(cog, i, offsets[i], bigtiff), bigtiff);
+		}
+
+		uint64_t file_size = header_size;
+		for (const cog_level_t &level : cog->levels)
+		{
+			file_size += level.spill_size;
+		}
+
+		if (bigtiff || file_size <= UINT32_MAX)
+		{
+			break;
+		}
+		bigtiff = true;
+	}
+
+	// The smallest overview comes first, the full resolution image last
+	uint64_t data_offset = header_size;
+	for (int i = level_count - 1; i >= 0; i--)
+	{
+		for (size_t t = 0; t < offsets[i].size(); t++)
+		{
+			offsets[i][t] = data_offset + cog->levels[i].offsets[t];
+		}
+		data_offset += cog->levels[i].spill_size;
+	}
+
+	std::vector<uchar> header;
+	header.push_back('I');
+	header.push_back('I');
+	if (bigtiff)
+	{
+		put_le(header, 43, 2);
+		put_le(header, 8, 2);
+		put_le(header, 0, 2);
+		put_le(header, 16, 8);
+	}
+	else
+	{
+		put_le(header, 42, 2);
+		put_le(header, 8, 4);
+	}
+
+	for (int i = 0; i < level_count; i++)
+	{
+		std::vector<tiff_entry_t> entries = cog_ifd_entries(cog, i, offsets[i], bigtiff);
+		uint64_t next_ifd = i + 1 < level_count ? header.size() + tiff_ifd_size(entries, bigtiff) : 0;
+		tiff_write_ifd(header, entries, next_ifd, bigtiff);
+	}
+
+	std::ofstream file(cog->file, std::ios::binary);
+	file.write((const char *)header.data(), header.size());
+
+	for (int i = level_count - 1; i >= 0; i--)
+	{
+		std::ifstream spill(cog->levels[i].spill_file, std::ios::binary);
+		if (cog->levels[i].spill_size > 0)
+		{
+			file << spill.rdbuf();
+		}
+		spill.close();
+
+		remove(cog->levels[i].spill_file.c_str());
+	}
+
+	if (!file)
+	{
+		ELOG("Could not write GeoTIFF file '%s'", cog->file.c_str());
+		return EIO;
+	}
+
+	LOG("Wrote GeoTIFF '%s' with %d overviews%s", cog->file.c_str(), level_count - 1, bigtiff ? " (BigTIFF)" : "");
+
+	return 0;
+}
@@ -44,7 +44,7 @@ typedef struct overflow
  * @param roi The region of interest that migh has overflow regarding the given image.
  * @param roi_overflow_px The output parameter containing the overflow.
  */
-void
+static void
 calc_overflow(cv::Mat img, cv::Rect roi, overflow_t *roi_overflow_px)
 {
 	roi_overflow_px->top = roi.y < 0 ? -roi.y : 0;
@@ -63,7 +63,7 @@ calc_overflow(cv::Mat img, cv::Rect roi, overflow_t *roi_overflow_px)
  * @param roi Region (rectangle) of interest. This will be changed and contains the area without the given overflow).
  * @param roi_overflow_px The overflow that should be removed from the rectangle.
  */
-void
+static void
 crop_roi(cv::Rect *roi, overflow_t *roi_overflow_px)
 {
 	roi->x += roi_overflow_px->left;
@@ -96,12 +96,12 @@ crop_roi(cv::Rect *roi, overflow_t *roi_overflow_px)
 /**
  * Cuts the given rectangle out of the given image.
  *
- * @param img The orginal image.
+ * @param img The orginal image with 8 bit per channel and 1, 3 or 4 channels.
  * @param roi The region of interest that should be cu out.
  * @param cropped_img The output image, which contains the region of interest.
  */
-void
-crop (cv::Mat img, cv::Rect roi, cv::Mat *cropped_img)
+static void
+crop(cv::Mat img, cv::Rect roi, cv::Mat *cropped_img)
 {
 	overflow_t roi_overflow_px;
 
@@ -118,10 +118,22 @@ crop (cv::Mat img, cv::Rect roi, cv::Mat *cropped_img)
 	 */
 	crop_roi(&roi, &roi_overflow_px);
 
-	// Crop the original image to the defined ROI.
-	cv::Mat crop = img(roi);
-
-	cvtColor(crop, crop, cv::COLOR_RGB2RGBA);
+	// Crop the original image to the defined ROI. The conversion writes into
+	// a separate matrix, because the image is shared with the threads building
+	// the pyramid and must only be read.
+	cv::Mat crop;
+	switch (img.channels())
+	{
+		case 1:
+			cvtColor(img(roi), crop, cv::COLOR_GRAY2RGBA);
+			break;
+		case 3:
+			cvtColor(img(roi), crop, cv::COLOR_RGB2RGBA);
+			break;
+		default:
+			// Already has an alpha channel, copyTo() below only reads it
+			crop = img(roi);
+	}
 
 	// Put the cropped image onto the transparent background.
 	cv::Rect overflow(roi_overflow_px.left, roi_overflow_px.top, crop.size().width, crop.size().height);
@@ -0,0 +1,792 @@
+#include <limits.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+#include <jpeglib.h>
+#include <tiffio.h>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * The image is split into this many parts per thread. More parts balance the
+ * work better and let the tiling start earlier.
+ */
+#define DECODE_PARTS_PER_THREAD 4
+
+/**
+ * Is called with the amount of finished rows (from the top) of the image.
+ *
+ * @return false when the decoding should be stopped, true otherwise.
+ */
+typedef std::function<bool(int rows)> rows_done_t;
+
+/**
+ * Fills the already allocated image and calls rows_done whenever more rows
+ * are finished.
+ *
+ * @return 0 when succeeded, a positive number if not.
+ */
+typedef std::function<int(cv::Mat img, rows_done_t rows_done)> image_fill_t;
+
+/**
+ * One part of a JPEG image that can be decoded independently, because it
+ * starts directly after a restart marker.
+ */
+typedef struct jpeg_part
+{
+	// Pixel rows of the image covered by this part
+	int first_row;
+	int rows;
+
+	// Pixel rows that are decoded for this part. With vertically subsampled
+	// chroma, the neighbouring MCU rows are decoded as well, so that the
+	// upsampling at the borders of the part sees the same chroma rows as
+	// when decoding the whole image.
+	int decode_first_row;
+	int decode_rows;
+
+	// Entropy coded data of the decoded rows
+	size_t data_start;
+	size_t data_end;
+} jpeg_part_t;
+
+/**
+ * The structure of a sequential JPEG file with restart markers.
+ */
+typedef struct jpeg_layout
+{
+	const uchar *data;
+	size_t size;
+
+	// Everything up to and including the SOS segment
+	size_t header_end;
+	// Position of the image height within the SOF segment
+	size_t sof_height_pos;
+
+	int width;
+	int height;
+	int components;
+
+	std::vector<jpeg_part_t> parts;
+} jpeg_layout_t;
+
+/**
+ * Error manager for libjpeg, which jumps back instead of exiting the process.
+ */
+typedef struct decode_jpeg_error
+{
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+} decode_jpeg_error_t;
+
+/**
+ * @return The seconds since the given point in time.
+ */
+static double
+seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+decode_jpeg_error_exit(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	ELOG("libjpeg: %s", message);
+
+	longjmp(((decode_jpeg_error_t *)cinfo->err)->jump, 1);
+}
+
+static void
+decode_jpeg_output_message(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	DLOG("libjpeg: %s", message);
+}
+
+/**
+ * Decodes the parts of an image with one thread per CPU. The parts are
+ * started from top to bottom and whenever the topmost unfinished parts are
+ * done, rows_done is called.
+ *
+ * @param part_count The amount of parts.
+ * @param decode_part Decodes one part and returns 0 when succeeded.
+ * @param part_end_row Returns the row below the given part.
+ * @param rows_done Is called with the amount of finished rows.
+ * @return 0 when succeeded, a positive number if not.
+ */
+static int
+decode_in_parallel(int part_count, std::function<int(int part)> decode_part, std::function<int(int part)> part_end_row, rows_done_t rows_done)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::atomic<int> next_part(0);
+	std::mutex mutex;
+	std::vector<bool> done(part_count, false);
+	int done_parts = 0;
+	int err = 0;
+
+	int thread_count = std::max(1, std::min(part_count, (int)std::thread::hardware_concurrency()));
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < thread_count; t++)
+	{
+		threads.push_back(std::thread([&]() {
+			for (int part = next_part++; part < part_count; part = next_part++)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (err != 0)
+					{
+						return;
+					}
+				}
+
+				int part_err = decode_part(part);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (part_err != 0)
+				{
+					err = err != 0 ? err : part_err;
+					return;
+				}
+
+				// Only a continuous block of rows from the top can be used
+				done[part] = true;
+				int old_done_parts = done_parts;
+				while (done_parts < part_count && done[done_parts])
+				{
+					done_parts++;
+				}
+
+				if (done_parts != old_done_parts && !rows_done(part_end_row(done_parts - 1)) && err == 0)
+				{
+					err = ECANCELED;
+				}
+			}
+		}));
+	}
+
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	if (err == 0)
+	{
+		LOG("Decoded image in %.2fs (%d parts, %d threads)", seconds_since(start), part_count, thread_count);
+	}
+
+	return err;
+}
+
+/**
+ * @return The amount of parts the image should be split into.
+ */
+static int
+decode_wanted_parts()
+{
+	return std::max(1, (int)std::thread::hardware_concurrency()) * DECODE_PARTS_PER_THREAD;
+}
+
+/**
+ * Determines the parts of a JPEG that can be decoded independently. This is
+ * only possible for sequential (non-progressive) JPEGs with restart markers,
+ * since the decoder state is reset at each restart marker.
+ *
+ * A part must start at the beginning of an MCU row directly after a restart
+ * marker with the number 7 (or at the beginning of the scan), because libjpeg
+ * expects the restart markers of a part to start with number 0.
+ *
+ * @param data The JPEG file.
+ * @param size The size of the JPEG file.
+ * @param layout Output parameter, the layout of the JPEG.
+ * @return true when the JPEG can be decoded in multiple parts, false
+ * otherwise.
+ */
+static bool
+jpeg_parse_layout(const uchar *data, size_t size, jpeg_layout_t *layout)
+{
+	if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+	{
+		return false;
+	}
+
+	layout->data = data;
+	layout->size = size;
+	layout->height = 0;
+	layout->components = 0;
+
+	int restart_interval = 0;
+	int h_max = 1;
+	int v_max = 1;
+	size_t pos = 2;
+
+	// Walk through the segments up to the start of the scan (SOS)
+	while (true)
+	{
+		// Markers may be preceded by fill bytes
+		while (pos + 1 < size && data[pos] == 0xFF && data[pos + 1] == 0xFF)
+		{
+			pos++;
+		}
+		if (pos + 4 > size || data[pos] != 0xFF)
+		{
+			return false;
+		}
+
+		uchar marker = data[pos + 1];
+		size_t segment = pos + 2;
+		size_t length = (data[segment] << 8) | data[segment + 1];
+		// The length includes its own two bytes
+		if (length < 2 || segment + length > size)
+		{
+			return false;
+		}
+
+		if (marker == 0xC0 || marker == 0xC1)
+		{
+			// Baseline or extended sequential with huffman coding
+			if (length < 8 || data[segment + 2] != 8)
+			{
+				return false;
+			}
+
+			layout->sof_height_pos = segment + 3;
+			layout->height = (data[segment + 3] << 8) | data[segment + 4];
+			layout->width = (data[segment + 5] << 8) | data[segment + 6];
+			layout->components = data[segment + 7];
+
+			if (length < 8 + 3 * (size_t)layout->components)
+			{
+				return false;
+			}
+			for (int c = 0; c < layout->components; c++)
+			{
+				uchar sampling = data[segment + 8 + 3 * c + 1];
+				h_max = std::max(h_max, sampling >> 4);
+				v_max = std::max(v_max, sampling & 0x0F);
+			}
+		}
+		else if ((marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8) || marker == 0xD9)
+		{
+			// Progressive, lossless or arithmetic coding or no image at all
+			return false;
+		}
+		else if (marker == 0xDD)
+		{
+			if (length < 4)
+			{
+				return false;
+			}
+			restart_interval = (data[segment + 2] << 8) | data[segment + 3];
+		}
+		else if (marker == 0xDA)
+		{
+			// Only one scan containing all components can be split
+			if (length < 3 || data[segment + 2] != layout->components)
+			{
+				return false;
+			}
+
+			layout->header_end = segment + length;
+			break;
+		}
+
+		pos = segment + length;
+	}
+
+	if (layout->height <= 0 || restart_interval == 0 || (layout->components != 1 && layout->components != 3))
+	{
+		return false;
+	}
+
+#ifndef JCS_EXTENSIONS
+	// Without libjpeg-turbo, there's no direct BGR output
+	if (layout->components == 3)
+	{
+		return false;
+	}
+#endif
+
+	// A single component is never interleaved and has 8x8 pixel MCUs
+	int mcu_width = layout->components == 1 ? 8 : 8 * h_max;
+	int mcu_height = layout->components == 1 ? 8 : 8 * v_max;
+	int mcus_per_row = (layout->width + mcu_width - 1) / mcu_width;
+	int mcu_rows = (layout->height + mcu_height - 1) / mcu_height;
+	long long segment_count = ((long long)mcus_per_row * mcu_rows + restart_interval - 1) / restart_interval;
+
+	// Find all restart markers (RST0 to RST7)
+	std::vector<size_t> markers;
+	pos = layout->header_end;
+	while (pos + 1 < size)
+	{
+		const uchar *next = (const uchar *)memchr(data + pos, 0xFF, size - pos - 1);
+		if (next == nullptr)
+		{
+			return false;
+		}
+		pos = next - data;
+
+		uchar marker = data[pos + 1];
+		if (marker == 0x00)
+		{
+			// Stuffed byte, this is data
+			pos += 2;
+		}
+		else if (marker == 0xFF)
+		{
+			// Fill byte
+			pos++;
+		}
+		else if (marker >= 0xD0 && marker <= 0xD7)
+		{
+			if ((size_t)(marker - 0xD0) != markers.size() % 8)
+			{
+				return false;
+			}
+			markers.push_back(pos);
+			pos += 2;
+		}
+		else
+		{
+			// End of the scan
+			break;
+		}
+	}
+	size_t scan_end = pos;
+
+	if ((long long)markers.size() != segment_count - 1)
+	{
+		return false;
+	}
+
+	// Amount of MCU rows between two possible part borders
+	int step = 8 * restart_interval / std::gcd(mcus_per_row, 8 * restart_interval);
+
+	// The upsampling of a row uses the chroma rows above and below it
+	int overlap = layout->components == 3 && v_max > 1 ? step : 0;
+	int part_mcu_rows = (mcu_rows + decode_wanted_parts() - 1) / decode_wanted_parts();
+	part_mcu_rows = std::max(step, (part_mcu_rows + step - 1) / step * step);
+
+	if (part_mcu_rows >= mcu_rows)
+	{
+		return false;
+	}
+
+	layout->parts.clear();
+	for (int row = 0; row < mcu_rows; row += part_mcu_rows)
+	{
+		int end_row = std::min(row + part_mcu_rows, mcu_rows);
+		int decode_row = std::max(row - overlap, 0);
+		int decode_end_row = std::min(end_row + overlap, mcu_rows);
+		long long first_segment = (long long)decode_row * mcus_per_row / restart_interval;
+		long long end_segment = decode_end_row == mcu_rows ? segment_count : (long long)decode_end_row * mcus_per_row / restart_interval;
+
+		jpeg_part_t part;
+		part.first_row = row * mcu_height;
+		part.rows = std::min(end_row * mcu_height, layout->height) - part.first_row;
+		part.decode_first_row = decode_row * mcu_height;
+		part.decode_rows = std::min(decode_end_row * mcu_height, layout->height) - part.decode_first_row;
+		part.data_start = first_segment == 0 ? layout->header_end : markers[first_segment - 1] + 2;
+		part.data_end = end_segment == segment_count ? scan_end : markers[end_segment - 1];
+		layout->parts.push_back(part);
+	}
+
+	return true;
+}
+
+/**
+ * Decodes one part of a JPEG directly into the rows of the image. The part is
+ * turned into a JPEG of its own by combining the original header (with the
+ * height of the decoded rows) and the data of the part. Decoded rows outside
+ * of the part (s. jpeg_part_t) are thrown away.
+ *
+ * @param layout The layout of the JPEG.
+ * @param part The part to decode.
+ * @param img The image to fill.
+ * @return 0 when succeeded, EIO if not.
+ */
+static int
+jpeg_decode_part(const jpeg_layout_t *layout, const jpeg_part_t *part, cv::Mat img)
+{
+	size_t data_size = part->data_end - part->data_start;
+	std::vector<uchar> stream(layout->header_end + data_size + 2);
+
+	memcpy(stream.data(), layout->data, layout->header_end);
+	memcpy(stream.data() + layout->header_end, layout->data + part->data_start, data_size);
+	stream[layout->sof_height_pos] = part->decode_rows >> 8;
+	stream[layout->sof_height_pos + 1] = part->decode_rows & 0xFF;
+	// End of image marker
+	stream[stream.size() - 2] = 0xFF;
+	stream[stream.size() - 1] = 0xD9;
+
+	// Everything with a destructor must exist before setjmp(), because the
+	// jump back skips the destructors of objects created afterwards
+	std::vector<uchar> discarded(layout->width * layout->components);
+	int skip_rows = part->first_row - part->decode_first_row;
+	int end_row = skip_rows + part->rows;
+
+	struct jpeg_decompress_struct cinfo;
+	decode_jpeg_error_t error;
+	cinfo.err = jpeg_std_error(&error.pub);
+	error.pub.error_exit = decode_jpeg_error_exit;
+	error.pub.output_message = decode_jpeg_output_message;
+
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return EIO;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, stream.data(), stream.size());
+	jpeg_read_header(&cinfo, TRUE);
+
+#ifdef JCS_EXTENSIONS
+	cinfo.out_color_space = layout->components == 1 ? JCS_GRAYSCALE : JCS_EXT_BGR;
+#else
+	cinfo.out_color_space = JCS_GRAYSCALE;
+#endif
+
+	// The rows below the part are only needed as context for the upsampling,
+	// which libjpeg reads ahead on its own. So the decoding stops after the
+	// last row of the part.
+	jpeg_start_decompress(&cinfo);
+	while ((int)cinfo.output_scanline < end_row)
+	{
+		int y = cinfo.output_scanline;
+		JSAMPROW row = y < skip_rows ? discarded.data() : img.ptr<uchar>(part->first_row + y - skip_rows);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_destroy_decompress(&cinfo);
+
+	return 0;
+}
+
+/**
+ * Prepares the parallel decoding of a JPEG with restart markers.
+ *
+ * @param data The JPEG file, must stay valid until the image is filled.
+ * @param size The size of the JPEG file.
+ * @param img Output parameter, the allocated but not yet decoded image.
+ * @param fill Output parameter, decodes the image.
+ * @return true when the JPEG can be decoded in parallel, false otherwise.
+ */
+static bool
+decode_jpeg_prepare(const uchar *data, size_t size, cv::Mat *img, image_fill_t *fill)
+{
+	std::shared_ptr<jpeg_layout_t> layout = std::make_shared<jpeg_layout_t>();
+	if (!jpeg_parse_layout(data, size, layout.get()))
+	{
+		return false;
+	}
+
+	*img = cv::Mat(layout->height, layout->width, CV_8UC(layout->components));
+	*fill = [layout](cv::Mat img, rows_done_t rows_done) {
+		return decode_in_parallel(layout->parts.size(), [layout, img](int part) {
+			return jpeg_decode_part(layout.get(), &layout->parts[part], img);
+		}, [layout](int part) {
+			return layout->parts[part].first_row + layout->parts[part].rows;
+		}, rows_done);
+	};
+
+	return true;
+}
+
+/**
+ * Warning handler for libtiff. Warnings like unknown tags (e.g. the GeoTIFF
+ * tags) are only printed as debug output, because each thread opens the file
+ * and would print them again.
+ */
+static void
+decode_tiff_warning(const char *module, const char *fmt, va_list args)
+{
+	char message[512];
+	vsnprintf(message, sizeof(message), fmt, args);
+	DLOG("libtiff: %s: %s", module != nullptr ? module : "", message);
+}
+
+/**
+ * Decodes the given rows of strips or tiles of a TIFF into the image. Each
+ * call opens its own TIFF handle, because libtiff handles can't be shared
+ * between threads.
+ *
+ * @param file The TIFF file.
+ * @param tiled True when the TIFF consists of tiles, false for strips.
+ * @param block_width The width of a tile (or of the image for strips).
+ * @param block_height The height of a tile or strip.
+ * @param first_row The first row of the image to decode, the begin of a strip
+ * or tile row.
+ * @param end_row The row below the last row to decode.
+ * @param img The image to fill.
+ * @return 0 when succeeded, EIO if not.
+ */
+static int
+tiff_decode_rows(const std::string &file, bool tiled, int block_width, int block_height, int first_row, int end_row, cv::Mat img)
+{
+	TIFF *tiff = TIFFOpen(file.c_str(), "r");
+	if (tiff == nullptr)
+	{
+		return EIO;
+	}
+
+	int channels = img.channels();
+	std::vector<uchar> buffer(tiled ? TIFFTileSize(tiff) : TIFFStripSize(tiff));
+	int err = 0;
+
+	for (int y = first_row; y < end_row && err == 0; y += block_height)
+	{
+		int rows = std::min(block_height, img.rows - y);
+
+		for (int x = 0; x < img.cols; x += block_width)
+		{
+			int columns = std::min(block_width, img.cols - x);
+
+			tmsize_t read;
+			if (tiled)
+			{
+				read = TIFFReadEncodedTile(tiff, TIFFComputeTile(tiff, x, y, 0, 0), buffer.data(), buffer.size());
+			}
+			else
+			{
+				read = TIFFReadEncodedStrip(tiff, TIFFComputeStrip(tiff, y, 0), buffer.data(), buffer.size());
+			}
+			if (read < 0)
+			{
+				err = EIO;
+				break;
+			}
+
+			for (int r = 0; r < rows; r++)
+			{
+				uchar *dst = img.ptr<uchar>(y + r) + x * channels;
+				memcpy(dst, buffer.data() + (size_t)r * block_width * channels, columns * channels);
+
+				// TIFF uses RGB(A), OpenCV uses BGR(A)
+				if (channels >= 3)
+				{
+					for (int c = 0; c < columns; c++)
+					{
+						std::swap(dst[c * channels], dst[c * channels + 2]);
+					}
+				}
+			}
+		}
+	}
+
+	TIFFClose(tiff);
+
+	return err;
+}
+
+/**
+ * Prepares the parallel decoding of a TIFF consisting of multiple strips or
+ * tiles. Only 8 bit gray, RGB and RGBA images are supported.
+ *
+ * @param file The TIFF file.
+ * @param img Output parameter, the allocated but not yet decoded image.
+ * @param fill Output parameter, decodes the image.
+ * @return true when the TIFF can be decoded in parallel, false otherwise.
+ */
+static bool
+decode_tiff_prepare(const std::string &file, cv::Mat *img, image_fill_t *fill)
+{
+	// Set before any thread opens the file, the handler is global
+	TIFFSetWarningHandler(decode_tiff_warning);
+
+	TIFF *tiff = TIFFOpen(file.c_str(), "r");
+	if (tiff == nullptr)
+	{
+		return false;
+	}
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint16_t bits_per_sample = 0;
+	uint16_t samples = 0;
+	uint16_t planar = 0;
+	uint16_t orientation = 0;
+	uint16_t photometric = 0;
+	uint32_t block_width = 0;
+	uint32_t block_height = 0;
+
+	TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_PLANARCONFIG, &planar);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation);
+
+	bool tiled = TIFFIsTiled(tiff);
+	if (tiled)
+	{
+		TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &block_width);
+		TIFFGetField(tiff, TIFFTAG_TILELENGTH, &block_height);
+	}
+	else
+	{
+		block_width = width;
+		TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &block_height);
+		block_height = std::min(block_height, height);
+	}
+
+	TIFFClose(tiff);
+
+	bool supported = bits_per_sample == 8 &&
+			planar == PLANARCONFIG_CONTIG &&
+			orientation == ORIENTATION_TOPLEFT &&
+			((samples == 1 && photometric == PHOTOMETRIC_MINISBLACK) ||
+			 ((samples == 3 || samples == 4) && photometric == PHOTOMETRIC_RGB));
+
+	if (!supported || width == 0 || block_width == 0 || block_height == 0 || block_height >= height)
+	{
+		return false;
+	}
+
+	// Each part consists of whole strips or rows of tiles
+	int block_rows = (height + block_height - 1) / block_height;
+	int blocks_per_part = (block_rows + decode_wanted_parts() - 1) / decode_wanted_parts();
+	int part_rows = blocks_per_part * block_height;
+	int part_count = (height + part_rows - 1) / part_rows;
+
+	*img = cv::Mat(height, width, CV_8UC(samples));
+	*fill = [file, tiled, block_width, block_height, part_rows, part_count](cv::Mat img, rows_done_t rows_done) {
+		return decode_in_parallel(part_count, [=](int part) {
+			int end_row = std::min((part + 1) * part_rows, img.rows);
+			return tiff_decode_rows(file, tiled, block_width, block_height, part * part_rows, end_row, img);
+		}, [part_rows, img](int part) {
+			return std::min((part + 1) * part_rows, img.rows);
+		}, rows_done);
+	};
+
+	return true;
+}
+
+/**
+ * Prepares the decoding of an encoded image in memory. JPEGs with restart
+ * markers are decoded in parallel by "fill", all other images are decoded
+ * directly.
+ *
+ * @param data The encoded image, must stay valid until the image is filled.
+ * @param size The size of the encoded image.
+ * @param img Output parameter, the decoded image or the allocated image that
+ * is decoded by "fill".
+ * @param fill Output parameter, empty when the image is already decoded.
+ * @return 0 when succeeded, EIO if the image could not be decoded.
+ */
+static int
+decode_buffer(const uchar *data, size_t size, cv::Mat *img, image_fill_t *fill)
+{
+	*fill = nullptr;
+
+	if (decode_jpeg_prepare(data, size, img, fill))
+	{
+		return 0;
+	}
+
+	// The size of a cv::Mat is limited to an int
+	if (size > INT_MAX)
+	{
+		ELOG("Images larger than 2 GiB can only be decoded in memory when they are JPEGs with restart markers");
+		return EIO;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Only wraps the given data, nothing is copied here
+	cv::Mat buffer(1, (int)size, CV_8U, (void *)data);
+	*img = cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
+	if (img->empty())
+	{
+		return EIO;
+	}
+
+	LOG("Decoded image in %.2fs", seconds_since(start));
+
+	return 0;
+}
+
+/**
+ * Prepares the decoding of an image file. TIFFs with multiple strips or tiles
+ * and JPEGs with restart markers are decoded in parallel by "fill", all other
+ * images are decoded directly.
+ *
+ * @param file The image file.
+ * @param img Output parameter, the decoded image or the allocated image that
+ * is decoded by "fill".
+ * @param fill Output parameter, empty when the image is already decoded.
+ * @return 0 when succeeded, EIO if the image could not be decoded.
+ */
+[[maybe_unused]] static int
+decode_file(const std::string &file, cv::Mat *img, image_fill_t *fill)
+{
+	*fill = nullptr;
+
+	std::ifstream stream(file, std::ios::binary | std::ios::ate);
+	if (!stream)
+	{
+		return EIO;
+	}
+	size_t size = stream.tellg();
+	stream.seekg(0);
+
+	uchar magic[4] = { 0, 0, 0, 0 };
+	stream.read((char *)magic, std::min(size, sizeof(magic)));
+
+	bool is_tiff = (magic[0] == 'I' && magic[1] == 'I' && magic[2] == 42) || (magic[0] == 'M' && magic[1] == 'M' && magic[3] == 42);
+	if (is_tiff && decode_tiff_prepare(file, img, fill))
+	{
+		return 0;
+	}
+
+	bool is_jpeg = magic[0] == 0xFF && magic[1] == 0xD8;
+	if (is_jpeg)
+	{
+		// The parts are decoded from memory. The file content is kept by
+		// "fill" and freed as soon as the image is decoded.
+		std::shared_ptr<std::vector<uchar>> buffer = std::make_shared<std::vector<uchar>>(size);
+		stream.seekg(0);
+		stream.read((char *)buffer->data(), size);
+		if (!stream)
+		{
+			return EIO;
+		}
+
+		image_fill_t jpeg_fill;
+		if (decode_jpeg_prepare(buffer->data(), buffer->size(), img, &jpeg_fill))
+		{
+			*fill = [buffer, jpeg_fill](cv::Mat img, rows_done_t rows_done) {
+				int err = jpeg_fill(img, rows_done);
+
+				buffer->clear();
+				buffer->shrink_to_fit();
+
+				return err;
+			};
+			return 0;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	*img = cv::imread(file, cv::IMREAD_UNCHANGED);
+	if (img->empty())
+	{
+		return EIO;
+	}
+
+	LOG("Decoded image in %.2fs", seconds_since(start));
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "libimage2tiles.h"
+
+#include "math.cpp"
+#include "logging.cpp"
+#include "crop.cpp"
+#include "settings.cpp"
+#include "pyramid.cpp"
+#include "decode.cpp"
+#include "adaptive.cpp"
+#include "tiles.cpp"
+
+/**
+ * Fills and verifies the settings and cuts the image into tiles.
+ *
+ * @see cut_tiles
+ */
+static int
+cut_image(cv::Mat img, image_fill_t fill, settings_t settings, tile_callback_t callback)
+{
+	fill_tile_settings(&settings);
+
+	int err = verify_settings(&settings);
+	if (err != 0)
+	{
+		return err;
+	}
+
+	// Tiles are the only output of the library
+	if (settings.variants.empty())
+	{
+		ELOG("At least one output tile size and format must be given");
+		return 2;
+	}
+
+	return cut_tiles(img, settings, callback, nullptr, fill);
+}
+
+void
+image2tiles_set_quiet(bool quiet)
+{
+	QUIET = quiet;
+}
+
+int
+image2tiles_cut_image(cv::Mat img, settings_t settings, tile_callback_t callback)
+{
+	if (img.empty())
+	{
+		ELOG("The given image is empty");
+		return EINVAL;
+	}
+
+	return cut_image(img, nullptr, settings, callback);
+}
+
+int
+image2tiles_cut_buffer(const uchar *data, size_t size, settings_t settings, tile_callback_t callback)
+{
+	cv::Mat img;
+	image_fill_t fill;
+
+	// JPEGs with restart markers are decoded in parallel while cutting
+	if (decode_buffer(data, size, &img, &fill) != 0)
+	{
+		ELOG("Could not decode image");
+		return EIO;
+	}
+
+	return cut_image(img, fill, settings, callback);
+}
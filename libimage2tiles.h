@@ -0,0 +1,140 @@
+#ifndef LIBIMAGE2TILES_H
+#define LIBIMAGE2TILES_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Marks the functions of the public API. The library is built with hidden
+ * symbols by default, so that only these functions are exported.
+ */
+#define IMAGE2TILES_API __attribute__((visibility("default")))
+
+/**
+ * An image point is the combination of a location within the image, using pixel X/Y coordinates, and a geo location, using longitude/latitude degrees.
+ */
+typedef struct
+{
+	int x;
+	int y;
+	double lon;
+	double lat;
+} img_point_t;
+
+/**
+ * A tile variant describes one output tile set. All variants are generated in
+ * one run from the same cropped regions of the image, e.g. a 256px and a 512px
+ * (@2x) tile set.
+ */
+typedef struct tile_variant
+{
+	// Width and height of the output tiles in pixel
+	int size;
+	// Image format and file extension without dot, e.g. "png"
+	std::string format;
+} tile_variant_t;
+
+/**
+ * This settings struct represents all necessary information to cut the given image into tiles.
+ *
+ * Some settings are set by the user and some are calculated in fill_tile_settings.
+ *
+ * @see default_settings
+ * @see fill_tile_settings
+ */
+typedef struct settings
+{
+	// Given from user via command line arguments
+	img_point_t p1;
+	img_point_t p2;
+	std::vector<tile_variant_t> variants;
+	std::string file;
+	std::string output_folder;
+	std::string cog_file;
+	bool dedup;
+	int zoom_level;
+
+	// Choose the encoder settings per tile by its complexity. When a target
+	// (tiles per second or total bytes of all tiles) is given, the settings
+	// are adjusted to meet it. A target of 0 means no target.
+	bool adaptive;
+	double target_tiles_per_second;
+	long byte_budget;
+
+	// Calculated based on the arguments above
+	int first_tile_x_px;
+	int first_tile_y_px;
+	int start_x_coord;
+	int start_y_coord;
+	float tile_size_px;
+
+	// Geo location of the top left image corner and the image resolution
+	double origin_long;
+	double origin_lat;
+	double pixel_per_long;
+	double pixel_per_lat;
+} settings_t;
+
+/**
+ * Is called for every finished tile.
+ *
+ * The "data" parameter contains the tile encoded in the format of the given
+ * variant and is only valid during the call, so copy it when it's needed
+ * afterwards. The callback is called once per variant for each tile.
+ *
+ * Returning something else than 0 stops the cutting process and the returned
+ * value is passed to the caller of the image2tiles_cut_* function.
+ */
+typedef std::function<int(int z, int x, int y, const tile_variant_t &variant, const std::vector<uchar> &data)> tile_callback_t;
+
+/**
+ * Sets the default values of all settings which are optional.
+ *
+ * @param settings The settings that will be filled with default values.
+ */
+IMAGE2TILES_API void
+default_settings(settings_t *settings);
+
+/**
+ * Turns all output of the library (including warnings and errors) off or on.
+ * Errors are still returned by the functions.
+ *
+ * @param quiet true to turn the output off.
+ */
+IMAGE2TILES_API void
+image2tiles_set_quiet(bool quiet);
+
+/**
+ * Cuts the given image into tiles. The image is not copied and not changed.
+ *
+ * Only the user settings (points, zoom level and variants) are used,
+ * the "file", "output_folder", "cog_file" and "dedup" settings are ignored. The calculated settings
+ * are determined by this function.
+ *
+ * @param img The image to cut.
+ * @param settings The settings describing the georeference and tiles.
+ * @param callback Is called for every encoded tile.
+ * @return 0 when succeeded, a positive number if not.
+ */
+IMAGE2TILES_API int
+image2tiles_cut_image(cv::Mat img, settings_t settings, tile_callback_t callback);
+
+/**
+ * Decodes the given encoded image (e.g. the content of a PNG or JPEG file)
+ * and cuts it into tiles. JPEGs with restart markers are decoded in parallel
+ * while the already decoded part is cut.
+ *
+ * @param data The encoded image data.
+ * @param size The amount of bytes in "data".
+ * @param settings The settings describing the georeference and tiles.
+ * @param callback Is called for every encoded tile.
+ * @return 0 when succeeded, a positive number if not.
+ * @see image2tiles_cut_image
+ */
+IMAGE2TILES_API int
+image2tiles_cut_buffer(const uchar *data, size_t size, settings_t settings, tile_callback_t callback);
+
+#endif
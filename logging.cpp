@@ -1,5 +1,6 @@
-int DEBUG = 0;
-int VERBOSE = 0;
+static int DEBUG = 0;
+static int VERBOSE = 0;
+static int QUIET = 0;
 
 /**
  * Prints debuggin information. The DEBUG flag (setting with "--debug") must be set.
@@ -16,50 +17,24 @@ int VERBOSE = 0;
 		printf(fmt "\n", ##__VA_ARGS__); \
 
 /**
- * Printing text which is always visible.
+ * Printing text which is always visible, unless the QUIET flag is set (s.
+ * image2tiles_set_quiet).
  */
 #define LOG(fmt, ...) \
-	printf(fmt "\n", ##__VA_ARGS__); \
+	if (!QUIET) \
+		printf(fmt "\n", ##__VA_ARGS__); \
 
 /**
- * Printing warning text which is always visible.
+ * Printing warning text which is always visible, unless the QUIET flag is set.
  */
 #define WLOG(fmt, ...) \
-	printf("WARNING: " fmt "\n", ##__VA_ARGS__); \
+	if (!QUIET) \
+		printf("WARNING: " fmt "\n", ##__VA_ARGS__); \
 
 /**
- * Printing text to stderr.
+ * Printing text to stderr, unless the QUIET flag is set.
  */
 #define ELOG(fmt, ...) \
-	fprintf(stderr, "ERROR: " fmt "\n", ##__VA_ARGS__); \
-
-/**
- * Asks the user to proceed.
- *
- * @return true is the user wants to proceed, false otherwise.
- */
-bool
-req_confirm()
-{
-	char choice;
-	bool success = false;
-
-    while(true)
-    {
-        std::cout << "Proceed? [Y/n]" << std::endl;
-        std::cin >> choice;
-
-        if (choice == 'N' || choice == 'n')
-		{
-			success = false;
-            break;
-        }
-		else if (choice == 'Y')
-		{
-			success = true;
-			break;
-		}
-    }
+	if (!QUIET) \
+		fprintf(stderr, "ERROR: " fmt "\n", ##__VA_ARGS__); \
 
-	return success;
-}
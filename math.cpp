@@ -5,7 +5,7 @@
  * 
  * @return -1 for negative number, 1 for positive number and 0 for 0
  */
-int
+[[maybe_unused]] static int
 sgn(double n)
 {
 	return (0 < n) - (n < 0);
@@ -16,7 +16,7 @@ sgn(double n)
  * 
  * @param number The number in degree
  */
-double
+static double
 dcos(double number) // TODO rename to cos_deg?
 {
 	return cos(number * M_PI / 180.0);
@@ -27,7 +27,7 @@ dcos(double number) // TODO rename to cos_deg?
  * 
  * @param number The number in degree
  */
-double
+static double
 dtan(double number) // TODO rename to tan_deg?
 {
 	return tan(number * M_PI / 180.0);
@@ -39,7 +39,7 @@ dtan(double number) // TODO rename to tan_deg?
  * @param lon Longitude degrees
  * @param z Zoom level
  */
-int
+static int
 long_to_tile_x(double lon, int z)
 {
 	return (int)(floor((lon + 180.0) / 360.0 * pow(2.0, z)));
@@ -51,7 +51,7 @@ long_to_tile_x(double lon, int z)
  * @param lat Latitude degrees
  * @param z Zoom level
  */
-int
+static int
 lat_to_tile_y(double lat, int z)
 {
 	return (int)(floor((1.0 - log(dtan(lat) + 1.0 / dcos(lat)) / M_PI) / 2.0 * pow(2.0, z)));
@@ -64,7 +64,7 @@ lat_to_tile_y(double lat, int z)
  * @param x X coordinate of the tile
  * @param z Zoom level
  */
-double
+static double
 tile_x_to_long(int x, int z)
 {
 	return x / pow(2, z) * 360.0 - 180;
@@ -77,7 +77,7 @@ tile_x_to_long(int x, int z)
  * @param y Y coordinate of the tile
  * @param z Zoom level
  */
-double
+static double
 tile_y_to_lat(int y, int z)
 {
 	double n = M_PI - 2.0 * M_PI * y / pow(2.0, z);
@@ -0,0 +1,242 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Amount of rows of the next level that are built at once. The rows of one
+ * strip are made available for the tiling when the whole strip is built.
+ */
+#define PYRAMID_STRIP_ROWS 128
+
+/**
+ * One level of the image pyramid, which is the image at one zoom level.
+ *
+ * The image data is allocated before the level is built and then filled strip
+ * by strip. Only the rows above "rows_ready" can be used.
+ */
+typedef struct pyramid_level
+{
+	cv::Size size;
+	cv::Mat img;
+	int rows_ready;
+} pyramid_level_t;
+
+/**
+ * The image pyramid contains the image for each zoom level. Level 0 is the
+ * original image (the highest zoom level) and each following level is half as
+ * large as the previous one.
+ *
+ * The levels are built in a background thread while the tiles of the already
+ * finished rows are cut. The mutex guards the "img" and "rows_ready" fields of
+ * all levels and "abort".
+ */
+typedef struct pyramid
+{
+	std::vector<pyramid_level_t> levels;
+	std::mutex mutex;
+	std::condition_variable rows_changed;
+	std::thread builder;
+	bool abort;
+} pyramid_t;
+
+/**
+ * Sets the amount of finished rows of a level and wakes up everyone waiting
+ * for rows.
+ *
+ * @param pyramid The pyramid.
+ * @param level The index of the level.
+ * @param rows The amount of rows (from the top) that are finished.
+ * @return false when the pyramid has been aborted, true otherwise.
+ */
+static bool
+pyramid_rows_done(pyramid_t *pyramid, int level, int rows)
+{
+	bool abort;
+	{
+		std::lock_guard<std::mutex> lock(pyramid->mutex);
+		pyramid->levels[level].rows_ready = rows;
+		abort = pyramid->abort;
+	}
+	pyramid->rows_changed.notify_all();
+
+	return !abort;
+}
+
+/**
+ * Waits until the given amount of rows of a level is finished.
+ *
+ * @param pyramid The pyramid.
+ * @param level The index of the level.
+ * @param rows The amount of rows (from the top) that are needed.
+ * @param img Output parameter, the image of this level. Only the finished rows
+ * must be used.
+ * @return false when the pyramid has been aborted, true otherwise.
+ */
+static bool
+pyramid_wait_rows(pyramid_t *pyramid, int level, int rows, cv::Mat *img)
+{
+	std::unique_lock<std::mutex> lock(pyramid->mutex);
+	pyramid->rows_changed.wait(lock, [pyramid, level, rows]() {
+		return pyramid->abort || pyramid->levels[level].rows_ready >= rows;
+	});
+
+	*img = pyramid->levels[level].img;
+	return !pyramid->abort;
+}
+
+/**
+ * Frees the image data of a level. The level must not be used afterwards.
+ *
+ * @param pyramid The pyramid.
+ * @param level The index of the level.
+ */
+static void
+pyramid_release(pyramid_t *pyramid, int level)
+{
+	std::lock_guard<std::mutex> lock(pyramid->mutex);
+	pyramid->levels[level].img.release();
+}
+
+/**
+ * Builds the level with the given index from the previous level. The rows of
+ * the new level are made available strip by strip.
+ *
+ * @param pyramid The pyramid.
+ * @param level The index of the level to build, must be greater than 0.
+ * @return false when the pyramid has been aborted, true otherwise.
+ */
+static bool
+pyramid_build_level(pyramid_t *pyramid, int level)
+{
+	pyramid_level_t *src_level = &pyramid->levels[level - 1];
+	pyramid_level_t *dst_level = &pyramid->levels[level];
+
+	cv::Mat src;
+	cv::Mat dst;
+	{
+		std::lock_guard<std::mutex> lock(pyramid->mutex);
+		src = src_level->img;
+		dst.create(dst_level->size, src.type());
+		dst_level->img = dst;
+	}
+
+	bool exact_halving = dst.cols * 2 <= src.cols && dst.rows * 2 <= src.rows;
+
+	if (!exact_halving)
+	{
+		// Images with one pixel width or height
+		if (!pyramid_wait_rows(pyramid, level - 1, src.rows, &src))
+		{
+			return false;
+		}
+
+		resize(src, dst, dst.size(), 0, 0, cv::INTER_AREA);
+		pyramid_rows_done(pyramid, level, dst.rows);
+		return true;
+	}
+
+	for (int strip_start = 0; strip_start < dst.rows; strip_start += PYRAMID_STRIP_ROWS)
+	{
+		int strip_end = std::min(strip_start + PYRAMID_STRIP_ROWS, dst.rows);
+
+		if (!pyramid_wait_rows(pyramid, level - 1, 2 * strip_end, &src))
+		{
+			return false;
+		}
+
+		/*
+		 * Resizing exactly by half averages 2x2 pixel blocks, OpenCV has a
+		 * parallel SIMD implementation for this. When the source has an odd
+		 * width or height, the last column or row is dropped, so pixel
+		 * positions stay exactly at half of the source, like the tile
+		 * positions do.
+		 */
+		cv::Mat src_strip = src(cv::Rect(0, 2 * strip_start, 2 * dst.cols, 2 * (strip_end - strip_start)));
+		cv::Mat dst_strip = dst.rowRange(strip_start, strip_end);
+		resize(src_strip, dst_strip, dst_strip.size(), 0, 0, cv::INTER_AREA);
+
+		pyramid_rows_done(pyramid, level, strip_end);
+	}
+
+	return true;
+}
+
+/**
+ * Aborts the pyramid. Everyone waiting for rows of the pyramid returns and the
+ * building stops.
+ *
+ * @param pyramid The pyramid to abort.
+ */
+static void
+pyramid_abort(pyramid_t *pyramid)
+{
+	{
+		std::lock_guard<std::mutex> lock(pyramid->mutex);
+		pyramid->abort = true;
+	}
+	pyramid->rows_changed.notify_all();
+}
+
+/**
+ * Initializes the pyramid and starts building all levels in a background
+ * thread.
+ *
+ * @param pyramid The pyramid to initialize.
+ * @param img The original image, which becomes level 0. It's not changed.
+ * @param level_count The amount of levels, including the original image.
+ * @param rows_ready The amount of rows of the original image that are already
+ * finished. When the image is still being decoded, the decoder reports the
+ * further rows using pyramid_rows_done.
+ */
+static void
+pyramid_start(pyramid_t *pyramid, cv::Mat img, int level_count, int rows_ready)
+{
+	pyramid->abort = false;
+	pyramid->levels.resize(level_count);
+
+	cv::Size size = img.size();
+	for (int i = 0; i < level_count; i++)
+	{
+		pyramid->levels[i].size = size;
+		pyramid->levels[i].rows_ready = 0;
+
+		size = cv::Size(std::max(1, size.width / 2), std::max(1, size.height / 2));
+	}
+
+	pyramid->levels[0].img = img;
+	pyramid->levels[0].rows_ready = rows_ready;
+
+	pyramid->builder = std::thread([pyramid, level_count]() {
+		try
+		{
+			for (int level = 1; level < level_count; level++)
+			{
+				if (!pyramid_build_level(pyramid, level))
+				{
+					break;
+				}
+			}
+		}
+		catch (const std::exception &e)
+		{
+			// Stops the tiling, which would wait forever for the missing rows
+			ELOG("Building the zoom levels failed: %s", e.what());
+			pyramid_abort(pyramid);
+		}
+	});
+}
+
+/**
+ * Stops building the pyramid (if not already finished) and waits for the
+ * background thread.
+ *
+ * @param pyramid The pyramid to stop.
+ */
+static void
+pyramid_stop(pyramid_t *pyramid)
+{
+	pyramid_abort(pyramid);
+	pyramid->builder.join();
+}
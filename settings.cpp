@@ -1,15 +1,4 @@
-/**
- * An image point is the combination of a location within the image, using pixel X/Y coordinates, and a geo location, using longitude/latitude degrees.
- */
-typedef struct
-{
-	int x;
-	int y;
-	double lon;
-	double lat;
-} img_point_t;
-
-bool operator==(const img_point_t& a, const img_point_t& b)
+static bool operator==(const img_point_t& a, const img_point_t& b)
 {
 	return (a.x == b.x) &&
 			(a.y == b.y) &&
@@ -18,192 +7,19 @@ bool operator==(const img_point_t& a, const img_point_t& b)
 }
 
 /**
- * This settings struct represents all necessary information to cut the given image into tiles.
- *
- * Some settings are set by the user and some are calculated in fill_tile_settings.
+ * Sets the default values of all optional settings.
  *
- * @see fill_tile_settings.
+ * @param settings The settings that will be filled.
  */
-typedef struct settings
-{
-	// Given from user via command line arguments
-	img_point_t p1;
-	img_point_t p2;
-	int output_tile_size;
-	std::string file;
-	std::string output_folder;
-	int zoom_level;
-
-	// Calculated based on the arguments above
-	int first_tile_x_px;
-	int first_tile_y_px;
-	int start_x_coord;
-	int start_y_coord;
-	float tile_size_px;
-} settings_t;
-
 void
-print_usage()
+default_settings(settings_t *settings)
 {
-	LOG("image2tiles - Cutting an image into XYZ-tiles.");
-	LOG("");
-	LOG("Options:");
-	LOG("  -1, --p1               First point using a point string (1)");
-	LOG("  -2, --p2               Second point using a point string (1)");
-	LOG("  -z, --max-zoom-level   Maximal zoom level (0..19). Tiles will have a");
-	LOG("                         zoom level less or equal to this.");
-	LOG("  -t, --tile-size        Size of a tile in pixel (default: 256)");
-	LOG("  -o, --output-folder    Output folder (defult: .out/)");
-	LOG("  -f, --file             The image file that should be cutted");
-	LOG("");
-	LOG("Flags:");
-	LOG("  -v, --verbose          More detailed output");
-	LOG("  -d, --debug            Even more output including debug logging");
-	LOG("      --version          Version of this application");
-	LOG("  -h, --help             Prints this message");
-	LOG("");
-	LOG("");
-	LOG("");
-	LOG("(1) Point string:");
-	LOG("");
-	LOG("A string representing the mapping from an image pixel to longitude/\n\
-latitude degrees. Specifying two points is used to determine the scale and\n\
-starting tiles of the image.");
-	LOG("It is formatted as followed:");
-	LOG("");
-	LOG("    <pixel-X>,<longitude>,<pixel-Y>,<latitude>");
-	LOG("");
-	LOG("Example:");
-	LOG("");
-	LOG("    771,43.55,220,-14.96");
-	LOG("");
-	LOG("The further away these points are on the image, the better is the\n\
-accuracy. Choosing the top-left and bottom-right corners of the image will\n\
-result in the best accuracy. Be sure the points do not have similar x oder y\n\
-coordinated (therefore two diagonal placed points are good)");
-	LOG("To fine the longitude/latitude of a point an online service can be used\n\
-(e.g. https://openstreetmap.org).");
-	LOG("");
-	LOG("");
-	LOG("");
-	LOG("License:     GPL-3.0");
-	LOG("Source code: https://github.com/hauke96/image2tiles");
-}
-
-void
-parse_args(int argc, char** argv, settings_t *settings)
-{
-	// Default settings
-	settings->output_tile_size = 256;
+	settings->variants = { { 256, "png" } };
 	settings->output_folder = "./out";
-
-	// Regex for parsing the points
-	std::string float_regex_str = "[+-]?[\\d]*\\.?[\\d]+";
-	std::string int_regex_str = "[-+]?\\d+";
-	// For example: --p1=100,20.123,100,64.123
-	std::regex point_regex("(" + int_regex_str + "),(" + float_regex_str + "),(" + int_regex_str + "),(" + float_regex_str + ")");
-
-	static struct option long_options[] = {
-		{"max-zoom-level", required_argument, 0, 'z' },
-		{"tile-size",      required_argument, 0, 't' },
-		{"p1",             required_argument, 0, '1' },
-		{"p2",             required_argument, 0, '2' },
-		{"file",           required_argument, 0, 'f' },
-		{"output-folder",  required_argument, 0, 'o' },
-		{"verbose",        no_argument,       0, 'v' },
-		{"version",        no_argument,       0,  0  },
-		{"debug",          no_argument,       0, 'd' },
-		{"help",           no_argument,       0, 'h' },
-		{0,                0,                 0,  0  }
-	};
-	
-	while (1)
-	{
-		int option_index = 0;
-		int c = getopt_long(argc, argv, "hvdo:f:z:1:2:t:",
-			long_options, &option_index);
-		if (c == -1)
-		{
-			break;
-		}
-
-		switch (c)
-		{
-			case 0:
-			{
-				std::string opt = long_options[option_index].name;
-
-				if (opt == "version")
-				{
-					LOG(VERSION);
-					exit(0);
-				}
-
-				break;
-			}
-			case '1': // fall through
-			case '2':
-			{
-				std::smatch matches;
-				std::string arg_str(optarg);
-				if (std::regex_search(arg_str, matches, point_regex))
-				{
-					img_point_t *p;
-					if (c == '1')
-					{
-						p = &settings->p1;
-					}
-					else
-					{
-						p = &settings->p2;
-					}
-					p->x = atoi(matches.str(1).c_str());
-					p->lon = std::stof(matches.str(2).c_str());
-					p->y = atoi(matches.str(3).c_str());
-					p->lat = std::stof(matches.str(4).c_str());
-					DLOG("> %d", p->x);
-					DLOG("> %f", p->lon);
-					DLOG("> %d", p->y);
-					DLOG("> %f", p->lat);
-				}
-				else
-				{
-					ELOG("Cannot parse point '%s'", optarg);
-					LOG("A correct point option would be: --p1=1,-23,45,+6.78");
-					LOG("(The + is optional and make sure there are no spaces)");
-					exit(EINVAL);
-				}
-
-				break;
-			}
-			case 't':
-				settings->output_tile_size = atoi(optarg);
-				break;
-			case 'v':
-				VERBOSE = 1;
-				break;
-			case 'd':
-				DEBUG = 1;
-				VERBOSE = 1;
-				break;
-			case 'f':
-				settings->file = optarg;
-				break;
-			case 'o':
-				settings->output_folder = optarg;
-				break;
-			case 'z':
-				settings->zoom_level = atoi(optarg);
-				break;
-			case 'h':
-				print_usage();
-				exit(0);
-			case '?':
-				ELOG("Unrecognized option '%s'", optarg);
-				// TODO maybe we should not directly exit here? When --help is specified, it would be nice to see the usage information anyway. Generally it would be nice to print the help message when an unrecognized parameter is passed.
-				exit(EINVAL);
-		}
-	}
+	settings->dedup = false;
+	settings->adaptive = false;
+	settings->target_tiles_per_second = 0;
+	settings->byte_budget = 0;
 }
 
 /**
@@ -211,7 +27,7 @@ parse_args(int argc, char** argv, settings_t *settings)
  *
  * @param settings The settings that will be filled.
  */
-void
+static void
 fill_tile_settings(settings_t *settings)
 {
 	int zoom_level = settings->zoom_level;
@@ -274,6 +90,11 @@ fill_tile_settings(settings_t *settings)
 	DLOG("origin_long: %f", origin_long);
 	DLOG("origin_lat: %f", origin_lat);
 
+	settings->origin_long = origin_long;
+	settings->origin_lat = origin_lat;
+	settings->pixel_per_long = pixel_per_long;
+	settings->pixel_per_lat = pixel_per_lat;
+
 	settings->start_x_coord = long_to_tile_x(origin_long, zoom_level);
 	settings->start_y_coord = lat_to_tile_y(origin_lat, zoom_level);
 
@@ -300,7 +121,7 @@ fill_tile_settings(settings_t *settings)
  * @param settings The settings to verify
  * @return 0 when succeeded, a positive number of not.
  */
-int
+static int
 verify_settings(settings_t *settings)
 {
 	// Points must not be equal
@@ -310,33 +131,33 @@ verify_settings(settings_t *settings)
 		return 1;
 	}
 
-	// output tile size valid
-	if (settings->output_tile_size <= 0)
+	// output tile variants valid
+	for (const tile_variant_t &variant : settings->variants)
 	{
-		ELOG("Output tile size must be greater than zero");
-		return 2;
+		if (variant.size <= 0)
+		{
+			ELOG("Output tile size must be greater than zero");
+			return 2;
+		}
+		if (!cv::haveImageWriter("." + variant.format))
+		{
+			ELOG("Output tile format '%s' is not supported", variant.format.c_str());
+			return 2;
+		}
 	}
 
-	// imput file exists
-	if (!std::experimental::filesystem::exists(settings->file))
+	// adaptive encoding has at most one target
+	if (settings->target_tiles_per_second < 0 || settings->byte_budget < 0)
 	{
-		ELOG("Input file does not exist");
-		return 3;
+		ELOG("The targets of the adaptive encoding must not be negative");
+		return 7;
 	}
-
-	// Output folder already exists -> Warning, data might be overwritten
-	if (std::experimental::filesystem::exists(settings->output_folder))
+	if (settings->target_tiles_per_second > 0 && settings->byte_budget > 0)
 	{
-		WLOG("There's already something called '%s'. Data might be overwritten.", settings->output_folder.c_str());
-		bool ok = req_confirm();
-
-		if (!ok)
-		{
-			// Exit but no error occured, so do not return an error code.
-			exit(0);
-		}
+		ELOG("Only one target (tiles per second or byte budget) can be used for the adaptive encoding");
+		return 7;
 	}
-	
+
 	// zoom level correct
 	if (settings->zoom_level < 0 || settings->zoom_level > 19)
 	{
@@ -0,0 +1,225 @@
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <unordered_map>
+#include <experimental/filesystem>
+
+/**
+ * A content-addressed store for encoded tiles. Each distinct tile content is
+ * written only once as "blob" into the ".blobs" folder of the output folder.
+ * The tile files are hardlinks to these blobs.
+ *
+ * The blobs are found by a hash and the size of their content. Before a tile
+ * is linked to a blob, their contents are compared, so different tiles with
+ * the same hash get different blobs.
+ */
+typedef struct tile_store
+{
+	std::string folder;
+
+	// Maps the identifier of the content to the paths of all blobs with this
+	// identifier
+	std::unordered_map<std::string, std::vector<std::string>> blobs;
+
+	long tile_count;
+	long blob_count;
+	long collision_count;
+	uint64_t tile_bytes;
+	uint64_t blob_bytes;
+} tile_store_t;
+
+/**
+ * Calculates a fast non-cryptographic 64 bit hash (MurmurHash64A).
+ *
+ * @param data The data to hash.
+ * @param size The amount of bytes in "data".
+ * @return The hash value.
+ */
+uint64_t
+hash_bytes(const uchar *data, size_t size)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+
+	uint64_t h = size * m;
+
+	const uchar *end = data + (size / 8) * 8;
+	for (const uchar *p = data; p != end; p += 8)
+	{
+		uint64_t k;
+		memcpy(&k, p, sizeof(k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	// Remaining bytes which don't fill a whole 64 bit block
+	size_t rest = size % 8;
+	if (rest != 0)
+	{
+		for (size_t i = 0; i < rest; i++)
+		{
+			h ^= (uint64_t)end[i] << (8 * i);
+		}
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+/**
+ * Initializes an empty store within the given output folder.
+ *
+ * @param store The store to initialize.
+ * @param output_folder The folder the tiles are written to.
+ */
+void
+store_init(tile_store_t *store, const std::string &output_folder)
+{
+	store->folder = output_folder + "/.blobs";
+	store->blobs.clear();
+	store->tile_count = 0;
+	store->blob_count = 0;
+	store->collision_count = 0;
+	store->tile_bytes = 0;
+	store->blob_bytes = 0;
+}
+
+/**
+ * Checks whether the blob has exactly the given content.
+ *
+ * @param blob_file The path of the blob.
+ * @param data The content to compare with.
+ * @return true when the contents are equal, false otherwise.
+ */
+bool
+store_blob_equals(const std::string &blob_file, const std::vector<uchar> &data)
+{
+	std::ifstream file(blob_file, std::ios::binary);
+	std::vector<uchar> content(data.size());
+	file.read((char *)content.data(), content.size());
+
+	// The blob must not be longer than the data
+	return file.gcount() == (std::streamsize)data.size() &&
+			file.peek() == std::ifstream::traits_type::eof() &&
+			content == data;
+}
+
+/**
+ * Stores the encoded tile under the given file name. When a tile with the same
+ * content has already been stored, only a hardlink is created, otherwise the
+ * content is written into a new blob first.
+ *
+ * @param store The store.
+ * @param data The encoded tile.
+ * @param file_name The path of the tile file, its folder must exist.
+ * @return 0 when succeeded, EIO if not.
+ */
+int
+store_tile(tile_store_t *store, const std::vector<uchar> &data, const std::string &file_name)
+{
+	namespace fs = std::experimental::filesystem;
+
+	char id[40];
+	snprintf(id, sizeof(id), "%016llx-%zu", (unsigned long long)hash_bytes(data.data(), data.size()), data.size());
+
+	store->tile_count++;
+	store->tile_bytes += data.size();
+
+	// An existing file (e.g. from an earlier run) prevents the linking
+	std::error_code error;
+	fs::remove(file_name, error);
+
+	std::vector<std::string> &candidates = store->blobs[id];
+	bool content_found = false;
+
+	// The newest blob comes first, the older ones of the same content may
+	// have reached the limit of links
+	for (auto blob = candidates.rbegin(); blob != candidates.rend(); blob++)
+	{
+		if (!store_blob_equals(*blob, data))
+		{
+			continue;
+		}
+		content_found = true;
+
+		fs::create_hard_link(*blob, file_name, error);
+		if (!error)
+		{
+			return 0;
+		}
+
+		// The file system limits the links per file, in this case a further
+		// blob with the same content is needed.
+		if (error != std::errc::too_many_links)
+		{
+			ELOG("Could not link tile '%s': %s", file_name.c_str(), error.message().c_str());
+			return EIO;
+		}
+		break;
+	}
+
+	if (!candidates.empty() && !content_found)
+	{
+		VLOG("Hash collision of tile '%s' with a different tile", file_name.c_str());
+		store->collision_count++;
+	}
+
+	std::string blob_folder = store->folder + "/" + std::string(id, 2);
+	std::string blob_file = blob_folder + "/" + id + "_" + std::to_string(store->blob_count) + fs::path(file_name).extension().string();
+	fs::create_directories(blob_folder);
+
+	// A blob of an earlier run may still be linked by tiles of that run
+	fs::remove(blob_file, error);
+
+	std::ofstream file(blob_file, std::ios::binary);
+	file.write((const char *)data.data(), data.size());
+	file.close();
+	if (!file)
+	{
+		ELOG("Could not write blob '%s'", blob_file.c_str());
+		return EIO;
+	}
+
+	candidates.push_back(blob_file);
+	store->blob_count++;
+	store->blob_bytes += data.size();
+
+	fs::create_hard_link(blob_file, file_name, error);
+	if (error)
+	{
+		ELOG("Could not link tile '%s': %s", file_name.c_str(), error.message().c_str());
+		return EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * Prints how many tiles have been deduplicated and how many bytes have been
+ * saved by this.
+ *
+ * @param store The store.
+ */
+void
+store_report(const tile_store_t *store)
+{
+	double ratio = store->blob_count > 0 ? (double)store->tile_count / store->blob_count : 1.0;
+	double saved_mib = (store->tile_bytes - store->blob_bytes) / (1024.0 * 1024.0);
+	double total_mib = store->tile_bytes / (1024.0 * 1024.0);
+
+	LOG("Deduplication: %ld of %ld tiles are unique (ratio %.2f), saved %.1f MiB of %.1f MiB", store->blob_count, store->tile_count, ratio, saved_mib, total_mib);
+
+	if (store->collision_count > 0)
+	{
+		LOG("Deduplication: %ld tiles had the same hash as a different tile and were stored separately", store->collision_count);
+	}
+}
@@ -0,0 +1,391 @@
+#include <opencv2/opencv.hpp>
+
+/**
+ * Is called once for every zoom level after all its tiles have been cut. The
+ * image is the complete image of this zoom level and must not be changed.
+ *
+ * Returning something else than 0 stops the cutting process.
+ */
+typedef std::function<int(int z, cv::Mat img)> level_callback_t;
+
+/**
+ * Resizes the cropped tile to every variant size, encodes it in the variant
+ * format and passes it to the callback. Variants with the same size share
+ * their resized image, so each size is resampled only once.
+ *
+ * @param cropped_img The tile cut out of the image in its original resolution.
+ * @param settings The settings containing the variants.
+ * @param x_coord The x coordinate of the tile.
+ * @param y_coord The y coordinate of the tile.
+ * @param z The zoom level of this tile.
+ * @param callback Is called for every encoded variant of the tile.
+ * @param adaptive Chooses the encoder settings per tile, may be null to use
+ * the default settings.
+ * @return 0 when succeeded, otherwise the value returned by the callback.
+ */
+static int
+encode_variants(cv::Mat cropped_img, const settings_t &settings, int x_coord, int y_coord, int z, tile_callback_t callback, adaptive_t *adaptive)
+{
+	cv::Mat resized_img;
+	int resized_size = -1;
+	double complexity = 0;
+	std::vector<uchar> encoded_tile;
+	std::vector<int> params;
+	std::string choice;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (const tile_variant_t &variant : settings.variants)
+	{
+		if (variant.size != resized_size)
+		{
+			resize(cropped_img, resized_img, cv::Size(variant.size, variant.size), 0, 0, cv::INTER_LINEAR_EXACT);
+			resized_size = variant.size;
+
+			if (adaptive != nullptr)
+			{
+				complexity = tile_complexity(resized_img);
+			}
+		}
+
+		if (adaptive != nullptr)
+		{
+			choice = adaptive_choose(adaptive, variant.format, complexity, &params);
+		}
+
+		cv::imencode("." + variant.format, resized_img, encoded_tile, params);
+
+		int err = callback(z, x_coord, y_coord, variant, encoded_tile);
+		if (err != 0)
+		{
+			return err;
+		}
+
+		// The resizing is accounted to the first variant of each size
+		if (adaptive != nullptr)
+		{
+			adaptive_tile_done(adaptive, choice, complexity, encoded_tile.size(), seconds_since(start));
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Moves the region of interest and the tile coordinates from one zoom level to
+ * the next smaller one.
+ *
+ * @param settings The settings with the position of the first tile, which is
+ * updated.
+ * @param roi The region of interest, which is updated.
+ */
+static void
+next_level_roi(settings_t *settings, cv::Rect *roi)
+{
+	roi->x = settings->first_tile_x_px;
+	roi->y = settings->first_tile_y_px;
+
+	/*
+	 * When the current coordinate is odd, the corner of the upper (upper
+	 * = one z layer less) tile is shifted
+	 *
+	 *    |x:100   'x':101  |x:102
+	 *    |x':50   '        |x':51
+	 * ---+-----------------+---
+	 *    |        '        |
+	 *    |        '        |
+	 *    |        '        |
+	 *  - + - - - - - - - - + -
+	 *    |        '        |
+	 *    |        '        |
+	 *    |        '        |
+	 * ---+-----------------+---
+	 *    |        ,        |
+	 *
+	 * x is the position on e.g. zoom level 13 and x' would then be the
+	 * position on zoom level 14 (higher zoom level means more tiles). If
+	 * a feature is on tile, which has the position x:101, it'll appear on
+	 * the tile x':50 whose origin is shifted to the left. This is only
+	 * the case when the original tile has an odd coordinate.
+	 */
+	if (settings->start_x_coord % 2 != 0)
+	{
+		roi->x -= roi->width;
+		settings->start_x_coord--;
+	}
+	if (settings->start_y_coord % 2 != 0)
+	{
+		roi->y -= roi->height;
+		settings->start_y_coord--;
+	}
+
+	// When the image is half as large, all distances and offsets have to
+	// be as well
+	roi->x /= 2;
+	roi->y /= 2;
+
+	// Because the loops are resetting the positions
+	settings->first_tile_x_px = roi->x;
+	settings->first_tile_y_px = roi->y;
+
+	// Actually update the x and y coordinates
+	settings->start_x_coord /= 2;
+	settings->start_y_coord /= 2;
+}
+
+/**
+ * Counts the tiles of all variants and zoom levels, which cut_pyramid will
+ * create.
+ *
+ * @param pyramid The pyramid with the sizes of all levels.
+ * @param settings The filled and verified settings.
+ * @return The amount of tiles.
+ */
+static long
+count_tiles(pyramid_t *pyramid, settings_t settings)
+{
+	cv::Rect roi(settings.first_tile_x_px, settings.first_tile_y_px, settings.tile_size_px, settings.tile_size_px);
+	long count = 0;
+
+	for (int z = settings.zoom_level; z >= 0; z--)
+	{
+		cv::Size size = pyramid->levels[settings.zoom_level - z].size;
+
+		// Same conditions as the loops in cut_pyramid
+		long columns = roi.x <= size.width ? (size.width - roi.x) / roi.width + 1 : 0;
+		long rows = roi.y <= size.height ? (size.height - roi.y) / roi.height + 1 : 0;
+		count += columns * rows;
+
+		next_level_roi(&settings, &roi);
+	}
+
+	return count * settings.variants.size();
+}
+
+/**
+ * Cuts all levels of the pyramid into tiles.
+ *
+ * @param pyramid The pyramid which is currently built.
+ * @param settings The filled and verified settings.
+ * @param callback Is called for every encoded tile.
+ * @param level_callback Is called for every finished zoom level, may be empty.
+ * @return 0 when succeeded, otherwise the first non-zero value returned by the
+ * callbacks.
+ * @see cut_tiles
+ */
+static int
+cut_pyramid(pyramid_t *pyramid, settings_t settings, tile_callback_t callback, level_callback_t level_callback)
+{
+	// Set Region of Interest
+	cv::Rect roi;
+	roi.x = settings.first_tile_x_px;
+	roi.y = settings.first_tile_y_px;
+	roi.width = settings.tile_size_px;
+	roi.height = settings.tile_size_px;
+
+	// Variants of the same size are next to each other, so that
+	// encode_variants() only resizes once per size.
+	std::stable_sort(settings.variants.begin(), settings.variants.end(), [](const tile_variant_t &a, const tile_variant_t &b) {
+		return a.size < b.size;
+	});
+
+	adaptive_t adaptive;
+	bool adaptive_tiles = settings.adaptive && !settings.variants.empty();
+	if (adaptive_tiles)
+	{
+		adaptive_init(&adaptive, settings, count_tiles(pyramid, settings));
+	}
+
+	cv::Mat img;
+
+	/*
+	 * These loops go from the most detailed zoom level up to the most
+	 * un-detailed zoom level (which is "0") and generate the tiles. The tiles
+	 * are cut row by row, because the rows of a level become available from
+	 * top to bottom (s. pyramid_t).
+	 */
+	for (int z = settings.zoom_level; z >= 0; z--)
+	{
+		int level = settings.zoom_level - z;
+		cv::Size size = pyramid->levels[level].size;
+
+		DLOG("y:%d, y:%d, w:%d, h:%d", roi.x, roi.y, roi.width, roi.height);
+
+		// Without variants, no tiles are requested at all
+		for (int y_coord = settings.start_y_coord; !settings.variants.empty() && roi.y <= size.height; y_coord++)
+		{
+			VLOG("Cut row Z:%d, Y:%d", z, y_coord);
+
+			// All image rows covered by this row of tiles must be finished
+			int rows_needed = std::min(roi.y + roi.height, size.height);
+			if (!pyramid_wait_rows(pyramid, level, rows_needed, &img))
+			{
+				return ECANCELED;
+			}
+
+			for (int x_coord = settings.start_x_coord; roi.x <= size.width; x_coord++)
+			{
+				/*
+				 * This generates and passes the tile for one zoom level and a
+				 * specific X/Y coordinate to the callback.
+				 *
+				 * 1. Create the matrix where the cropped image (which is the
+				 *    tile) should be stored in.
+				 * 2. The part of the tile is cut out of the original image
+				 *    (without changing it). This is done by the crop(...)
+				 *    function. This function also removes overflow (s.
+				 *    overflow_t) and returns a tile with transparent bakground
+				 *    (important at the edged of the original image).
+				 * 3. Resize the raw tile to the output size of each variant
+				 *    (usually 256x256), encode it and hand it over to the
+				 *    callback. The crop is shared by all variants.
+				 * 4. Adjust the x-coordinate in the original image to get the
+				 *    next tile.
+				 */
+				cv::Mat cropped_img(roi.width, roi.height, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+				crop(img, roi, &cropped_img);
+
+				int err = encode_variants(cropped_img, settings, x_coord, y_coord, z, callback, adaptive_tiles ? &adaptive : nullptr);
+				if (err != 0)
+				{
+					return err;
+				}
+
+				roi.x += roi.width;
+			}
+
+			// Go to the next "row" and begin at the left of the image
+			roi.y += roi.height;
+			roi.x = settings.first_tile_x_px;
+		}
+
+		if (adaptive_tiles)
+		{
+			adaptive_level_done(&adaptive, z);
+		}
+
+		if (level_callback)
+		{
+			if (!pyramid_wait_rows(pyramid, level, size.height, &img))
+			{
+				return ECANCELED;
+			}
+
+			int err = level_callback(z, img);
+			if (err != 0)
+			{
+				return err;
+			}
+		}
+
+		// This level is completely built, so the previous level (from which
+		// it has been built) is not needed anymore.
+		img.release();
+		if (level > 0)
+		{
+			pyramid_release(pyramid, level - 1);
+		}
+
+		next_level_roi(&settings, &roi);
+	}
+
+	if (adaptive_tiles)
+	{
+		adaptive_report(&adaptive);
+	}
+
+	return 0;
+}
+
+/**
+ * Cuts the image into tiles for all zoom levels from settings.zoom_level down
+ * to 0. Each tile is encoded once per variant and passed to the given
+ * callback.
+ *
+ * The smaller zoom levels are built in the background while the tiles of
+ * already finished image rows are cut. When the image is still to be decoded
+ * (s. decode_file), this happens in the background as well and the tiling
+ * starts on the rows that are already decoded.
+ *
+ * @param img The image to cut. Only the header is copied, the pixel data of
+ * the caller is never changed.
+ * @param settings The filled and verified settings.
+ * @param callback Is called for every encoded tile.
+ * @param level_callback Is called for every finished zoom level, may be empty.
+ * @param fill Decodes the allocated image, may be empty when the image is
+ * already decoded.
+ * @return 0 when succeeded, EINVAL for unsupported images, otherwise the first
+ * non-zero value returned by the callbacks or the decoder.
+ */
+static int
+cut_tiles(cv::Mat img, settings_t settings, tile_callback_t callback, level_callback_t level_callback, image_fill_t fill)
+{
+	// Supported by crop(), which creates the RGBA tiles
+	int channels = img.channels();
+	if (img.depth() != CV_8U || (channels != 1 && channels != 3 && channels != 4))
+	{
+		ELOG("Only images with 8 bit per channel and 1, 3 or 4 channels are supported");
+		return EINVAL;
+	}
+
+	pyramid_t pyramid;
+	pyramid_start(&pyramid, img, settings.zoom_level + 1, fill ? 0 : img.rows);
+
+	int fill_err = 0;
+	std::thread decoder;
+	if (fill)
+	{
+		decoder = std::thread([&pyramid, &fill, &fill_err, img]() {
+			fill_err = fill(img, [&pyramid](int rows) {
+				return pyramid_rows_done(&pyramid, 0, rows);
+			});
+
+			// Stops the tiling, which would wait forever for the missing rows
+			if (fill_err != 0)
+			{
+				pyramid_abort(&pyramid);
+			}
+		});
+	}
+
+	/*
+	 * The threads must be stopped before leaving this function, otherwise
+	 * their destructors terminate the process. So exceptions (e.g. from
+	 * OpenCV or the callbacks) are turned into an error here.
+	 */
+	int err;
+	try
+	{
+		err = cut_pyramid(&pyramid, settings, callback, level_callback);
+	}
+	catch (const std::exception &e)
+	{
+		ELOG("Cutting the image failed: %s", e.what());
+		err = EIO;
+	}
+	catch (...)
+	{
+		ELOG("Cutting the image failed with an unknown exception");
+		err = EIO;
+	}
+
+	pyramid_stop(&pyramid);
+	if (decoder.joinable())
+	{
+		decoder.join();
+	}
+
+	/*
+	 * When the tiling failed, pyramid_stop() stops the decoder as well, so
+	 * its error (ECANCELED) must not replace the one of the tiling. The error
+	 * of the decoder is only used when the tiling succeeded or was stopped
+	 * because of the decoder.
+	 */
+	if (fill_err != 0 && (err == 0 || err == ECANCELED))
+	{
+		return fill_err;
+	}
+
+	return err;
+}